@@ -0,0 +1,59 @@
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include "simulator.h"
+#include "trace.h"
+
+/* Channel models used by tolayer3() to decide the fate of each packet.   */
+/* The defaults reproduce the original emulator: an independent Bernoulli */
+/* loss draw against -l and the fixed 'Z'/999999 corruption against -c.   */
+/* Either direction can instead replay a recorded trace, which then       */
+/* decides loss, delay and corruption for every packet it carries.        */
+/* All flows share the channel; an optional bottleneck serializes the     */
+/* A->B direction at a fixed packet rate behind a drop-tail queue.        */
+
+/* loss models */
+#define  LOSS_BERNOULLI    0   /* independent draw against lossprob */
+#define  LOSS_GILBERT      1   /* two-state Gilbert-Elliott chain */
+
+/* corruption models */
+#define  CORRUPT_FIXED     0   /* payload[0]='Z' or seqnum/acknum=999999 */
+#define  CORRUPT_BER       1   /* independent bit flips at a bit error rate */
+
+struct gilbert_params {
+  float p_gb;        /* P(good -> bad) per packet */
+  float p_bg;        /* P(bad -> good) per packet */
+  float loss_good;   /* loss probability while in the good state */
+  float loss_bad;    /* loss probability while in the bad state */
+};
+
+/* a store-and-forward link direction: packets leave back to back at    */
+/* rate packets per time unit, behind a drop-tail queue of queue packets */
+struct link {
+  float rate;        /* packets per time unit, 0 for unlimited */
+  int queue;         /* packets the link holds, 0 for unlimited */
+  double free;       /* time the link finishes its current backlog */
+  int sent;          /* packets admitted */
+  int drops;         /* packets dropped on a full queue */
+  int maxq;          /* largest backlog seen */
+};
+
+float jimsrand();
+
+int link_admit(struct link *l, float now, float *depart);
+
+/* configuration, called while parsing the command line */
+int channel_set_gilbert(const char *arg);
+int channel_set_ber(const char *arg);
+int channel_set_trace(int AorB, const char *path);
+int channel_set_bottleneck(const char *arg);
+
+/* per-packet decisions; AorB is the sending entity (one chain per direction) */
+int channel_admit(int AorB, float now, float *depart);
+int channel_lose(int AorB);
+float channel_arrival(int AorB, float now, float lastime);
+int channel_corrupt(int AorB, struct pktbuf **bp);   /* unshares *bp before damaging it */
+
+void channel_report(float now);
+
+#endif
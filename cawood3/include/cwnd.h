@@ -0,0 +1,58 @@
+#ifndef CWND_H_
+#define CWND_H_
+
+#include "seqnum.h"
+
+/* Congestion control.  Without --cc a sender keeps -w packets in      */
+/* flight, whatever the channel does with them.  With --cc aimd each    */
+/* flow's A grows a congestion window from one packet:                  */
+/*   slow start      cwnd += 1 per packet ACKed, up to ssthresh         */
+/*   avoidance       cwnd += 1/cwnd per packet ACKed                    */
+/*   loss            ssthresh = cwnd / 2, cwnd = ssthresh               */
+/*   timeout         ssthresh = cwnd / 2, cwnd = 1                      */
+/* and sends no more than min(cwnd, -w, B's window).  Losses found in   */
+/* one window of data cut cwnd once: after a cut, losses among packets  */
+/* sent before it are ignored (NewReno's recovery point).  ssthresh     */
+/* starts at -w unless given.  --cwnd-log writes every change as a      */
+/* time series: time, flow, cwnd, ssthresh, protocol.  A --protocol     */
+/* sweep writes all its runs to the one file, told apart by protocol.   */
+
+#define  CC_NONE        0
+#define  CC_AIMD        1
+
+/* arg is one of: none, aimd[,ssthresh] */
+int cc_set(const char *arg);
+int cc_mode();
+int cc_log(const char *path);
+void cc_log_protocol(const char *name);   /* tag the rows that follow */
+
+/* one per flow, kept by the sender */
+struct congestion {
+  float cwnd = 0;
+  float ssthresh = 0;
+  seq_t recover = 0;       /* losses before this were already counted */
+
+  void init();
+  int window() const;      /* packets A may have in flight, at most -w */
+
+  /* window(), capped by B's advertised window rwnd (-1 until B has  */
+  /* sent one).  A zero window still lets one packet through so its  */
+  /* retransmissions probe B.                                        */
+  int send_window(int rwnd) const
+  {
+    int w = window();
+
+    if (rwnd >= 0 && rwnd < w)
+      w = rwnd;
+    return w > 0 ? w : 1;
+  }
+
+  void acked(unsigned n);  /* n more packets ACKed */
+  void loss(seq_t base, seq_t next);  /* a packet from base on was lost */
+  void timeout(seq_t next);           /* the retransmission timer went off */
+};
+
+/* each flow's window over the run */
+void cc_report();
+
+#endif
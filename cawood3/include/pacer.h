@@ -0,0 +1,48 @@
+#ifndef PACER_H_
+#define PACER_H_
+
+/* Pacing.  Without --pace, a packet reaches the channel the moment   */
+/* the transport hands it to tolayer3(), so a window sent at once     */
+/* meets a bottleneck as one burst.  --pace puts a token bucket       */
+/* between each flow's A and the channel:                             */
+/*   tokens accrue at rate packets per time unit, up to burst         */
+/*   a packet goes as soon as there is a token for it; otherwise it   */
+/*   waits, in order, in the flow's pacer queue                       */
+/* --pace auto sets each flow's rate to PACE_GAIN times the fastest   */
+/* its ACKs have come back lately, as BBR does: each ACK gives a rate */
+/* over the last PACE_SPAN of them, and the highest of the last       */
+/* PACE_SAMPLES is used, so a stall after losses doesn't slow the     */
+/* pacer down with it.  It holds nothing until it has a rate.         */
+/* B's ACKs are never paced.  --pace off holds nothing either, but    */
+/* still measures, so runs with and without pacing can be compared.  */
+
+#define  PACE_OFF       0
+#define  PACE_RATE      1
+#define  PACE_AUTO      2
+
+#define  PACE_GAIN      1.25
+#define  PACE_SPAN      32
+#define  PACE_SAMPLES   32
+
+/* arg is one of: off, rate[,burst], auto[,burst] */
+int pace_set(const char *arg);
+int pace_mode();
+
+void pace_init(int nflows);
+
+/* take a token for flow f's next packet, if there is one now.  due   */
+/* means the token was scheduled for now, so rounding can't hold it.  */
+int pace_take(int f, float now, int due);
+float pace_due(int f, float now);   /* when flow f will have a token */
+
+/* events, for the rate estimate and the report */
+void pace_ack(int f, float now);    /* an ACK reached flow f's A */
+void pace_sent(int f, float now, float wait);  /* a packet went to the channel */
+void pace_queued(int f, int len);   /* a packet joined the pacer queue */
+void pace_absorbed(int f);          /* a packet was resent while still in it */
+void pace_dropped(int f);           /* a packet was dropped at the bottleneck */
+
+/* burst sizes, waits and drops per flow */
+void pace_report();
+
+#endif
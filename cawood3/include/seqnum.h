@@ -0,0 +1,71 @@
+#ifndef SEQNUM_H_
+#define SEQNUM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "simulator.h"
+
+/* Sequence numbers.  Protocols count with free-running unsigned      */
+/* seq_t counters and put only the low getseqbits() bits of them in    */
+/* a packet (all 32 when --seqbits is not given).  A number read back  */
+/* from a packet is turned into a counter again relative to one the    */
+/* receiver already has, which is correct as long as the window rules  */
+/* below keep the candidates fewer than 2^k:                           */
+/*   Go-Back-N        window <= 2^k - 1                                */
+/*   Selective Repeat window <= 2^(k-1)                                */
+/* Counters are only ever compared through their difference, so they  */
+/* may wrap too.                                                       */
+
+typedef unsigned int seq_t;
+
+/* 2^k, or 0 for the full 32 bits */
+inline seq_t seq_space()
+{
+  return getseqbits() ? (seq_t)1 << getseqbits() : 0;
+}
+
+/* what goes in seqnum/acknum */
+inline int seq_wire(seq_t s)
+{
+  return getseqbits() ? (int)(s & (seq_space() - 1)) : (int)s;
+}
+
+/* the counter with wire's low bits at or after ref, for numbers that */
+/* can only be ahead of ref (a Go-Back-N cumulative ACK)              */
+inline seq_t seq_forward(int wire, seq_t ref)
+{
+  if (getseqbits() == 0)
+    return (seq_t)wire;
+  return ref + (((seq_t)wire - ref) & (seq_space() - 1));
+}
+
+/* the counter with wire's low bits nearest ref, either side of it */
+inline seq_t seq_nearest(int wire, seq_t ref)
+{
+  seq_t d;
+
+  if (getseqbits() == 0)
+    return (seq_t)wire;
+  d = ((seq_t)wire - ref) & (seq_space() - 1);
+  if (d >= seq_space() / 2)
+    d -= seq_space();              /* behind ref */
+  return ref + d;
+}
+
+/* a before b, a at or before b, allowing for wrap */
+inline bool seq_lt(seq_t a, seq_t b)  { return (int)(a - b) < 0; }
+inline bool seq_leq(seq_t a, seq_t b) { return (int)(a - b) <= 0; }
+
+/* called from A_init(): stop the run if -w is more than the protocol */
+/* can tell apart with --seqbits, most being its limit for this k     */
+inline void seq_check_window(const char *protocol, seq_t most)
+{
+  if (getseqbits() && (seq_t)getwinsize() > most) {
+    fprintf(stderr, "%s: a window of %d needs more than %d-bit sequence numbers (at most %u)\n",
+            protocol, getwinsize(), getseqbits(), most);
+    exit(-1);
+  }
+}
+
+#endif
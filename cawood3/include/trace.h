@@ -0,0 +1,41 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stddef.h>
+
+/* A recorded per-packet channel trace.  The file is plain text, one     */
+/* packet per line, in the order packets were offered to the link:       */
+/*                                                                        */
+/*     <lost> <delay> <corrupt>                                           */
+/*                                                                        */
+/*   lost     0 or 1                                                      */
+/*   delay    one-way delay in time units (ignored when lost)             */
+/*   corrupt  0 intact, 1 payload, 2 seqnum, 3 acknum                     */
+/*                                                                        */
+/* Blank lines and lines starting with '#' are skipped.  The file is      */
+/* memory-mapped and read front to back; pages already consumed are       */
+/* handed back to the kernel, so traces larger than RAM replay fine.     */
+
+struct trace_rec {
+  int lost;
+  float delay;
+  int corrupt;
+};
+
+struct trace_reader {
+  const char *name;
+  int fd;
+  const char *base;        /* start of the mapping */
+  size_t len;              /* file length */
+  size_t pos;              /* offset of the next unread byte */
+  size_t released;         /* bytes before this offset were released */
+  long line;               /* current line, for error messages */
+  long records;            /* records returned so far */
+  int wraps;               /* times the trace was restarted from the top */
+};
+
+int trace_open(struct trace_reader *tr, const char *path);
+int trace_next(struct trace_reader *tr, struct trace_rec *rec);
+void trace_close(struct trace_reader *tr);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef TRAFFIC_H_
+#define TRAFFIC_H_
+
+/* Layer 5 arrival processes.  Every source except the legacy one draws */
+/* from its own per-flow random stream, so changing the traffic never   */
+/* perturbs the channel's loss and corruption draws, and vice versa.    */
+/* -t sets the mean gap between messages for the random sources.        */
+
+#define  TRAFFIC_LEGACY    0   /* uniform on [0,2*lambda] from the channel RNG */
+#define  TRAFFIC_UNIFORM   1   /* uniform on [0,2*lambda] */
+#define  TRAFFIC_POISSON   2   /* exponential gaps, mean lambda */
+#define  TRAFFIC_ONOFF     3   /* exponential on/off periods, Poisson while on */
+#define  TRAFFIC_SATURATE  4   /* always backlogged: every message at once */
+#define  TRAFFIC_TRACE     5   /* arrival times read from a file */
+
+/* arg is one of: uniform, poisson, onoff:<on>,<off>, saturate, trace:<file> */
+int traffic_set(const char *arg);
+void traffic_init(int seed, int nflows, float lambda);
+int traffic_model();
+
+/* true if the source stops on its own (saturate, trace), in which case  */
+/* the run ends once everything has been delivered rather than at the   */
+/* arrival that would exceed -m                                          */
+int traffic_drains();
+
+/* time from now until flow's next arrival, or -1 once it has run dry */
+float traffic_next_gap(int flow, float now);
+
+void traffic_report();
+
+#endif
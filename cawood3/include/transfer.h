@@ -0,0 +1,29 @@
+#ifndef TRANSFER_H_
+#define TRANSFER_H_
+
+#include "simulator.h"
+
+/* Bulk file transfer.  Instead of letters, layer 5 at A hands the       */
+/* transport successive 20-byte chunks of a file (the last one padded    */
+/* with zeros), and each flow sends the whole file once.  Layer 5 at B   */
+/* streams what it reads into a 64-bit FNV-1a hash, and optionally into  */
+/* an output file, so the copy can be checked against the original.     */
+
+int transfer_open(const char *path);
+int transfer_set_output(const char *path);
+void transfer_init(int nflows);
+int transfer_active();
+
+/* number of messages the file is split into */
+int transfer_messages();
+
+/* the next chunk of flow's copy, handed to A at time now */
+void transfer_next_msg(int flow, float now, struct msg *m);
+
+/* B's application of flow read the next chunk at time now */
+void transfer_deliver(int flow, float now, const char *data);
+
+/* completion time and goodput of every flow's transfer */
+void transfer_report();
+
+#endif
@@ -0,0 +1,289 @@
+#ifndef WINDOW_H_
+#define WINDOW_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "seqnum.h"
+
+/* Sliding-window building blocks for the window protocols.          */
+/*                                                                   */
+/*   sliding_window<T, Storage, Ack>                                 */
+/*     Storage  dynamic_ring<T>     capacity set by reserve()        */
+/*     Ack      cumulative_ack      an ACK covers all before it (GBN)*/
+/*              selective_ack       an ACK covers one packet (SR)    */
+/*   receive_window<T>              out-of-order packets held at a   */
+/*                                  receiver until their turn        */
+/*   ring_queue<T>                  bounded FIFO, e.g. a backlog     */
+/*                                                                   */
+/* Sequence numbers are free-running unsigned counters.  A slot is   */
+/* found from its sequence number alone by masking, since rings are  */
+/* a power of two long, and all comparisons are differences, so they */
+/* stay right when the counters wrap.                                */
+
+inline unsigned next_pow2(unsigned n)
+{
+  unsigned p = 1;
+
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+/* Storage */
+
+/* rounded up to a power of two, so lookups always mask */
+template <class T> struct dynamic_ring {
+  std::vector<T> slot;
+  unsigned mask = 0;
+
+  void reserve(unsigned n)
+  {
+    slot.assign(next_pow2(n), T());
+    mask = slot.size() - 1;
+  }
+  unsigned capacity() const { return slot.size(); }
+  unsigned index(seq_t s) const { return s & mask; }
+  T *data() { return &slot[0]; }
+  T &operator[](seq_t s) { return slot[s & mask]; }
+  const T &operator[](seq_t s) const { return slot[s & mask]; }
+};
+
+/* One bit per ring slot, scanned a 64-bit word at a time */
+class ring_bitmap {
+  std::vector<uint64_t> words;
+  unsigned nbits = 0;
+
+public:
+  void reserve(unsigned n)
+  {
+    nbits = n;
+    words.assign((n + 63) / 64, 0);
+  }
+  bool test(unsigned i) const { return words[i >> 6] >> (i & 63) & 1; }
+  void set(unsigned i) { words[i >> 6] |= (uint64_t)1 << (i & 63); }
+  void clear(unsigned i) { words[i >> 6] &= ~((uint64_t)1 << (i & 63)); }
+
+  /* how many bits are set in a row from position i, wrapping at the */
+  /* end of the ring, looking at no more than max of them            */
+  unsigned run(unsigned i, unsigned max) const
+  {
+    unsigned n = 0, bit, avail, ones;
+    uint64_t rest;
+
+    while (n < max) {
+      bit = i & 63;
+      avail = 64 - bit;
+      if (avail > nbits - i)
+        avail = nbits - i;              /* the ring ends inside this word */
+      if (avail > max - n)
+        avail = max - n;
+      rest = ~(words[i >> 6] >> bit);
+      ones = rest == 0 ? 64 : __builtin_ctzll(rest);
+      if (ones < avail)
+        return n + ones;
+      n += avail;
+      i += avail;
+      if (i == nbits)
+        i = 0;
+    }
+    return n;
+  }
+};
+
+/* ACK policies.  ack() acknowledges seq, calls release() on every */
+/* slot that becomes acknowledged, and returns how far the base    */
+/* moved.                                                          */
+
+struct cumulative_ack {
+  template <class W, class F> static unsigned ack(W &w, seq_t seq, F release)
+  {
+    if (!w.outstanding(seq))
+      return 0;
+    return w.slide(seq - w.base() + 1, release);
+  }
+};
+
+struct selective_ack {
+  template <class W, class F> static unsigned ack(W &w, seq_t seq, F release)
+  {
+    if (!w.outstanding(seq) || w.acked(seq))
+      return 0;
+    release(w[seq]);
+    w.mark(seq);
+    return w.slide(w.acked_run(), [](typename W::value_type &) { });
+  }
+};
+
+template <class T, class Storage = dynamic_ring<T>, class Ack = cumulative_ack>
+class sliding_window {
+  Storage ring;
+  ring_bitmap ackd;        /* selective_ack only: acknowledged, not yet slid past */
+  seq_t base_ = 0;         /* oldest unacknowledged */
+  seq_t next_ = 0;         /* next to be sent */
+  unsigned limit_ = 0;     /* at most this many outstanding */
+
+public:
+  typedef T value_type;
+
+  /* room for n outstanding packets */
+  void reserve(unsigned n)
+  {
+    ring.reserve(n);
+    ackd.reserve(ring.capacity());
+    set_limit(n);
+  }
+
+  unsigned capacity() const { return limit_; }
+  seq_t base() const { return base_; }
+  seq_t next() const { return next_; }
+  unsigned size() const { return next_ - base_; }
+  bool empty() const { return next_ == base_; }
+  bool full() const { return size() >= limit_; }
+
+  /* sent and not yet acknowledged */
+  bool outstanding(seq_t s) const { return s - base_ < next_ - base_; }
+  /* inside the window, sent or not */
+  bool in_window(seq_t s) const { return s - base_ < limit_; }
+
+  T &operator[](seq_t s) { return ring[s]; }
+  const T &operator[](seq_t s) const { return ring[s]; }
+  unsigned slot(seq_t s) const { return ring.index(s); }
+
+  /* call f(p, len) on the slots of s .. s+n-1 as at most two arrays, */
+  /* split where the ring wraps, e.g. to send them in a batch         */
+  template <class F> void spans(seq_t s, unsigned n, F f)
+  {
+    unsigned i = ring.index(s), first = ring.capacity() - i;
+
+    if (n <= first)
+      f(ring.data() + i, n);
+    else {
+      f(ring.data() + i, first);
+      f(ring.data(), n - first);
+    }
+  }
+
+  /* the slot for the next sequence number, for the caller to fill. */
+  /* Only valid when !full().                                        */
+  T &push() { return ring[next_++]; }
+
+  template <class F> unsigned ack(seq_t s, F release) { return Ack::ack(*this, s, release); }
+  unsigned ack(seq_t s) { return Ack::ack(*this, s, [](T &) { }); }
+
+  /* selective_ack bookkeeping */
+  bool acked(seq_t s) const { return ackd.test(ring.index(s)); }
+  void mark(seq_t s) { ackd.set(ring.index(s)); }
+  unsigned acked_run() const { return ackd.run(ring.index(base_), size()); }
+
+  /* move the base up n slots, releasing each */
+  template <class F> unsigned slide(unsigned n, F release)
+  {
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+      release(ring[base_]);
+      ackd.clear(ring.index(base_));
+      base_++;
+    }
+    return n;
+  }
+
+  /* limit_ can shrink below size() when a peer's window closes; new */
+  /* sends wait until acknowledgments bring size() under it again    */
+  void set_limit(unsigned n) { limit_ = n < ring.capacity() ? n : ring.capacity(); }
+};
+
+/* The receiving end of a selective-repeat window: a slot for each of */
+/* the limit sequence numbers from base() on, and a bitmap of which   */
+/* have arrived.  ready() counts the run at the base that can go up   */
+/* in order, read in place through spans().                           */
+template <class T> class receive_window {
+  dynamic_ring<T> ring;
+  ring_bitmap have_;
+  seq_t base_ = 0;         /* next in-order sequence number */
+  unsigned limit_ = 0;
+
+public:
+  void reserve(unsigned n)
+  {
+    ring.reserve(n);
+    have_.reserve(ring.capacity());
+    limit_ = n;
+  }
+
+  unsigned capacity() const { return limit_; }
+  seq_t base() const { return base_; }
+  bool in_window(seq_t s) const { return s - base_ < limit_; }
+  bool have(seq_t s) const { return have_.test(ring.index(s)); }
+  T &operator[](seq_t s) { return ring[s]; }
+
+  /* the slot for s, which from now on counts as arrived */
+  T &put(seq_t s)
+  {
+    have_.set(ring.index(s));
+    return ring[s];
+  }
+
+  /* arrived in a row from the base */
+  unsigned ready() const { return have_.run(ring.index(base_), limit_); }
+
+  /* as sliding_window::spans() */
+  template <class F> void spans(seq_t s, unsigned n, F f)
+  {
+    unsigned i = ring.index(s), first = ring.capacity() - i;
+
+    if (n <= first)
+      f(ring.data() + i, n);
+    else {
+      f(ring.data() + i, first);
+      f(ring.data(), n - first);
+    }
+  }
+
+  /* the n packets at the base have gone up; move past them */
+  void deliver(unsigned n)
+  {
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+      have_.clear(ring.index(base_++));
+  }
+};
+
+/* Bounded FIFO on a power-of-two ring, O(1) at both ends */
+template <class T> class ring_queue {
+  dynamic_ring<T> ring;
+  seq_t head = 0, tail = 0;
+  unsigned limit = 0;
+
+public:
+  void reserve(unsigned n)
+  {
+    ring.reserve(n);
+    limit = n;
+  }
+  unsigned capacity() const { return limit; }
+  unsigned size() const { return tail - head; }
+  bool empty() const { return head == tail; }
+  bool full() const { return size() >= limit; }
+  void push(const T &v) { ring[tail++] = v; }
+
+  /* double the capacity, for a queue with no fixed bound */
+  void grow()
+  {
+    dynamic_ring<T> bigger;
+    seq_t s;
+
+    bigger.reserve(2 * (limit > 0 ? limit : 1));
+    for (s = head; s != tail; s++)
+      bigger[s] = ring[s];
+    ring = bigger;
+    limit = ring.capacity();
+  }
+  T &front() { return ring[head]; }
+  T pop() { return ring[head++]; }
+};
+
+#endif
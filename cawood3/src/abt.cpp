@@ -1,7 +1,14 @@
-#include "../include/simulator.h"
+#include "../include/protocol.h"
+#include "../include/checksum.h"
+#include "../include/seqnum.h"
+#include "../include/ackpolicy.h"
+#include "../include/rto.h"
 #include <iostream>
 #include <cstring>
 #include <list>
+#include <vector>
+
+namespace {
 
 /* ******************************************************************
  ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
@@ -20,38 +27,44 @@
 #define SEEKING_ACK false
 #define AWAITING_OUT true
 
-std::list<msg> messageBuffer;
-
 float TIMEOUT = 150.00; // timeout param
-int SEQNUM; // will always be either 0 or 1 for abt protocol, the SEQNUM for A
-bool A_STATE; // when true, awaiting input from layer 5, when false awaiting ACK from layer 3
-int B_SEQNUM; // will always be either 0 or 1 for abt protocol, the SEQNUM for B
-struct pkt sendBuffer; // holds the last packet sent so it can be
-						 // resent if its lost or corrupted
+
+// per-flow connection state, one entry per A/B pair (see get_flow())
+struct abtFlow {
+	std::list<msg> messageBuffer;
+	int SEQNUM; // 0 or 1 (below 2^k with --seqbits), the SEQNUM for A
+	bool A_STATE; // when true, awaiting input from layer 5, when false awaiting ACK from layer 3
+	int B_SEQNUM; // 0 or 1 (below 2^k with --seqbits), the SEQNUM for B
+	struct pkt sendBuffer; // holds the last packet sent so it can be
+							 // resent if its lost or corrupted
+	delayed_ack delack; // the ACK B is holding back, see --ackdelay
+	int heldAck; // the seqnum that ACK is for
+	rto_estimator rto; // A's retransmission timeout, see --rto
+	float sentAt; // when sendBuffer first went out
+	bool resent; // sendBuffer went out more than once, so its ACK is no RTT sample
+};
+std::vector<abtFlow> flows;
+
+abtFlow &thisFlow()
+{
+	// sized on first use, once the simulator knows how many flows it runs
+	if (flows.empty())
+		flows.resize(get_nflows());
+	return flows[get_flow()];
+}
+
 // ACK seqnum aliasing
 int ACK = -1;
 // Calling entity value aliasing
 int A = 0;
 int B = 1;
 
-int getChecksum(struct pkt packet)
+// the sequence number after seq: abt alternates between 0 and 1
+// unless --seqbits gives it more to count through
+int nextSeq(int seq)
 {
-
-	int checksum = 0;
-
-	// will likely need to check to make sure this is a valid way to
-	// calculate the checksum.
-
-	// checksum seqnum
-	checksum += packet.seqnum;
-	// checksum acknum
-	checksum += packet.acknum;
-	// checksum payload
-	for (unsigned int i = 0; i < 20; i++)
-	{
-		checksum += (int)packet.payload[i];
-	}
-	return checksum;
+	seq_t space = seq_space() ? seq_space() : 2;
+	return (seq + 1) % space;
 }
 
 pkt makePacket(int seqnum, int acknum, struct msg message)
@@ -60,16 +73,18 @@ pkt makePacket(int seqnum, int acknum, struct msg message)
 	struct pkt packet;
 
 	// set seqnum
-	packet.seqnum = SEQNUM;
+	packet.seqnum = seqnum;
 	// set acknum
-	packet.acknum = SEQNUM;
+	packet.acknum = acknum;
+	// abt has no window to advertise
+	packet.rcvwnd = 0;
 
 	// package message data into packet payload
-	strncpy(packet.payload, message.data, sizeof(message.data));
+	memcpy(packet.payload, message.data, sizeof(message.data));
 
 	int checksum = 0;
 	// calculate checksum
-	checksum = getChecksum(packet);
+	checksum = pkt_checksum(&packet);
 
 	// set checksum
 	packet.checksum = checksum;
@@ -80,19 +95,28 @@ pkt makePacket(int seqnum, int acknum, struct msg message)
 
 void enqueueMsg(struct msg message)
 {
+	abtFlow &f = thisFlow();
 	// add the message to the end of the queue
-	messageBuffer.push_back(message);
+	f.messageBuffer.push_back(message);
+
+	// once the buffer is full, layer 5 has to wait for room
+	if (getsndbuf() > 0 && f.messageBuffer.size() >= (unsigned int)getsndbuf())
+		blocklayer5(A);
 }
 
 msg dequeueMsg()
 {
+	abtFlow &f = thisFlow();
 	struct msg message;
 
 	// get the front packet (packets are dequeued in fifo order)
-	message = messageBuffer.front();
+	message = f.messageBuffer.front();
 
 	// remove the first element from the list
-	messageBuffer.pop_front();
+	f.messageBuffer.pop_front();
+
+	// there is room in the buffer again
+	unblocklayer5(A);
 
 	// send this packet back to the caller
 	return message;
@@ -102,30 +126,33 @@ msg dequeueMsg()
 /* called from layer 5, passed the data to be sent to other side */
 void A_output(struct msg message)
 {
+	abtFlow &f = thisFlow();
 	printf("new msg : %s ", message.data);
-	printf("curr seq %i", SEQNUM);
+	printf("curr seq %i", f.SEQNUM);
 	printf("@ %f\n",get_sim_time());
 
 	// check if the packet is ready to be sent
 
-	if (A_STATE == AWAITING_OUT) // is A awaiting a message from layer 5?, (A_STATE == true)
+	if (f.A_STATE == AWAITING_OUT) // is A awaiting a message from layer 5?, (A_STATE == true)
 	{
 		// A is ready to send a packet
 
 		//make the packet
-		struct pkt packet = makePacket(SEQNUM,SEQNUM,message);
+		struct pkt packet = makePacket(f.SEQNUM,f.SEQNUM,message);
 
 		// buffer packet to be sent, to resend if failed
-		sendBuffer = packet;
+		f.sendBuffer = packet;
+		f.sentAt = get_sim_time();
+		f.resent = false;
 
 		// send packet to layer 3
 		tolayer3(A,packet);
 
 		// change A_STATE, accepting ACK response from B
-		A_STATE = SEEKING_ACK;
+		f.A_STATE = SEEKING_ACK;
 
-		// start timer A, timeout after TIMEOUT
-		starttimer(A,TIMEOUT);
+		// start timer A, timeout after TIMEOUT (or the --rto estimate)
+		starttimer(A,f.rto.timeout());
 	}
 	else
 	{
@@ -139,21 +166,27 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4 */
 void A_input(struct pkt packet)
 {
-	int checksum = getChecksum(packet); // calculate checksum
-	if (checksum == packet.checksum && A_STATE == SEEKING_ACK) // compare checksums, is packet corrupt? AND Check if awaiting ACK (A_STATE == false)
+	abtFlow &f = thisFlow();
+	int checksum = pkt_checksum(&packet); // calculate checksum
+	if (checksum == packet.checksum && f.A_STATE == SEEKING_ACK) // compare checksums, is packet corrupt? AND Check if awaiting ACK (A_STATE == false)
 	{
 		// packet is not corrupt, compare seqnum to acknum
-		if (packet.acknum == SEQNUM)
+		if (packet.acknum == f.SEQNUM)
 		{
 			// Stop the timer
 			stoptimer(A);
 
+			// time the round trip, unless the packet was resent (Karn)
+			if (!f.resent)
+				f.rto.sample(get_sim_time() - f.sentAt);
+			f.rto.acked();
+
 			// Change sequence number
-			// if seqnum == 0, set it to 1, else set it to 0
-			SEQNUM = (SEQNUM == 0) ? 1:0;
+			// 0 becomes 1 and 1 becomes 0, or the count goes on with --seqbits
+			f.SEQNUM = nextSeq(f.SEQNUM);
 
 			// change A_STATE to receive to messages from layer5
-			A_STATE = AWAITING_OUT;
+			f.A_STATE = AWAITING_OUT;
 
 		}
 		else
@@ -170,16 +203,18 @@ void A_input(struct pkt packet)
 
 	}
 
-	if (A_STATE == AWAITING_OUT && !messageBuffer.empty())
+	if (f.A_STATE == AWAITING_OUT && !f.messageBuffer.empty())
 	{
 		// if we got here, we just ack'd a packet, and there are packets
 		// still in the buffer
 
 		// send the next packet from the buffer to layer 3
-		struct pkt packet = makePacket(SEQNUM,SEQNUM,dequeueMsg());
+		struct pkt packet = makePacket(f.SEQNUM,f.SEQNUM,dequeueMsg());
 
 		// buffer sent packet
-		sendBuffer = packet;
+		f.sendBuffer = packet;
+		f.sentAt = get_sim_time();
+		f.resent = false;
 
 		//printf("dequeue: %s ", packet.payload);
 		//printf("%i ", packet.seqnum);
@@ -189,48 +224,71 @@ void A_input(struct pkt packet)
 		tolayer3(A,packet);
 
 		// change the state, waiting for next ack
-		A_STATE = SEEKING_ACK;
+		f.A_STATE = SEEKING_ACK;
 
 		// restart the timer
-		starttimer(A, TIMEOUT);
+		starttimer(A, f.rto.timeout());
 	}
 }
 
 /* called when A's timer goes off */
 void A_timerinterrupt()
 {
+	abtFlow &f = thisFlow();
 	// send copy of packet again
-	tolayer3(A,sendBuffer);
+	tolayer3(A,f.sendBuffer);
+	f.resent = true;
+	// wait twice as long this time (with --rto adaptive)
+	f.rto.backoff();
 	// change the state, waiting for next ack
-	A_STATE = SEEKING_ACK;
+	f.A_STATE = SEEKING_ACK;
 	// restart timer
-	starttimer(A,TIMEOUT);
+	starttimer(A,f.rto.timeout());
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
 void A_init()
 {
-	SEQNUM = 0;
-	A_STATE = AWAITING_OUT;
+	abtFlow &f = thisFlow();
+	f.SEQNUM = 0;
+	f.A_STATE = AWAITING_OUT;
+	f.rto.init(TIMEOUT);
 
 }
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
 
+// send A the ACK for acknum; it covers anything B was holding
+void sendAck(abtFlow &f, int acknum)
+{
+	struct pkt packetACK = {};
+	packetACK.seqnum = ACK;
+	packetACK.acknum = acknum;
+	packetACK.rcvwnd = 0;
+	packetACK.checksum = pkt_checksum(&packetACK);
+	tolayer3(B,packetACK);
+	f.delack.sent();
+}
+
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 void B_input(struct pkt packet)
 {
+	abtFlow &f = thisFlow();
 
-	printf("B %i ", B_SEQNUM);
+	printf("B %i ", f.B_SEQNUM);
 	printf("recieved : %s",packet.payload);
 	printf(" %i",packet.seqnum);
 	printf(" @ %f\n",get_sim_time());
-	int checksum = getChecksum(packet); // calculate checksum
+	int checksum = pkt_checksum(&packet); // calculate checksum
 	if (checksum == packet.checksum) // compare checksums, is packet corrupt?
 	{
 		// packet is not corrupt, compare seqnum to acknum
-		if (packet.seqnum == B_SEQNUM)
+		if (packet.seqnum == f.B_SEQNUM && getrcvwnd(B) == 0)
+		{
+			// layer 5 has no room for it, stay quiet so A times out and resends
+		}
+		else if (packet.seqnum == f.B_SEQNUM)
 		{
 			/*
 			////////////////////
@@ -244,52 +302,44 @@ void B_input(struct pkt packet)
 			// deliver message to layer 5
 			tolayer5(B, (char *)packet.payload);
 
-			/////////////////////
-			// send packet ACK //
-
-			// new packet instance
-			struct pkt packetACK;
-
-			// set seqnum to ACK
-			packetACK.seqnum = ACK;
-
-			// the seqnum B is acknowledging
-			packetACK.acknum = B_SEQNUM;
-
-			int checksum = 0;
-			// calculate checksum
-			checksum = getChecksum(packetACK);
-
-			// set checksum
-			packetACK.checksum = checksum;
-
-			// send packet to layer 3
-			tolayer3(B,packetACK);
+			// send packet ACK, unless it waits for --ackdelay
+			// (stop and wait never has a second packet in flight to
+			// share it with, so --ackevery only holds it until A resends)
+			f.heldAck = f.B_SEQNUM;
+			if (f.delack.arrived())
+				sendAck(f, f.B_SEQNUM);
 
 			// change to next state
-			// if seqnum == 0, set it to 1, else set it to 0
-			B_SEQNUM = (B_SEQNUM == 0) ? 1:0;
+			// 0 becomes 1 and 1 becomes 0, or the count goes on with --seqbits
+			f.B_SEQNUM = nextSeq(f.B_SEQNUM);
 			printf("finished a send %f\n",get_sim_time());
 		}
+		else if (f.delack.held > 0)
+		{
+			// A resent the packet B is holding the ACK for, send it now
+			sendAck(f, f.heldAck);
+		}
 		else
 		{
 			// if we're here, that means the acknum we got is different from the seqnum
 			printf("wrong ack? %i ", packet.seqnum);
-			printf(" %i \n", B_SEQNUM);
+			printf(" %i \n", f.B_SEQNUM);
 			// new packet instance
-			struct pkt packetACK;
+			struct pkt packetACK = {};
 
 			// set seqnum
 			packetACK.seqnum = ACK;
 
-			// set acknum B should reply with
-			// it should be noted that in this scope, the SEQNUM
-			// does not equal the SEQNUM on the A side.
-			packetACK.acknum = B_SEQNUM;
+			// a duplicate: B's ACK for it was lost, so ACK it again.
+			// A only takes an ACK for the seqnum it sent; B_SEQNUM has
+			// already moved on to the next one, and ACKing that would
+			// leave A resending this packet forever
+			packetACK.acknum = packet.seqnum;
+			packetACK.rcvwnd = 0;
 
 			int checksum = 0;
 			// calculate checksum
-			checksum = getChecksum(packetACK);
+			checksum = pkt_checksum(&packetACK);
 
 			// set checksum
 			packetACK.checksum = checksum;
@@ -306,15 +356,30 @@ void B_input(struct pkt packet)
 		printf("\nSomething corrupted?____________\n");
 		printf("%s\n",packet.payload);
 		printf("%i\n",packet.seqnum);
-		printf("B_SEQNUM %i\n\n",B_SEQNUM);
+		printf("B_SEQNUM %i\n\n",f.B_SEQNUM);
 
 	}
 }
+
+/* called when B's timer goes off */
+void B_timerinterrupt()
+{
+	abtFlow &f = thisFlow();
+	// the held ACK has waited --ackdelay
+	if (f.delack.expired())
+		sendAck(f, f.heldAck);
+}
+
 //llllllllllllllllllll�@
 //
 /* the following rouytine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init()
 {
-	B_SEQNUM = 0;
+	abtFlow &f = thisFlow();
+	f.B_SEQNUM = 0;
 }
+
+}
+
+REGISTER_PROTOCOL("abt")
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "../include/simulator.h"
+#include "../include/cwnd.h"
+
+/*****************************************************************
+ AIMD congestion control.  Each sender keeps a congestion struct
+ and asks it how many packets it may have in flight; the rules
+ are in cwnd.h.  This file also follows every flow's window over
+ time, for the report and for --cwnd-log.
+******************************************************************/
+
+int cc_mode_ = CC_NONE;
+float cc_ssthresh = 0;         /* initial ssthresh, 0 for -w */
+FILE *cc_fp = NULL;            /* --cwnd-log */
+const char *cc_proto = "";     /* protocol running, to tag its rows */
+
+/* statistics, per flow */
+struct cc_stats {
+  double area = 0.0;           /* integral of cwnd over time */
+  float since = 0;             /* when cwnd last changed */
+  float cwnd = 0;              /* ..to this */
+  float max = 0;
+  long cuts = 0;               /* multiplicative decreases on loss */
+  long timeouts = 0;
+};
+std::vector<cc_stats> cc_flows;
+
+int cc_set(const char *arg)
+{
+  float ss = 0;
+
+  if (strcmp(arg, "none") == 0)
+    cc_mode_ = CC_NONE;
+  else if (strncmp(arg, "aimd", 4) == 0) {
+    if (arg[4] == ',' && (sscanf(arg + 5, "%f", &ss) != 1 || ss < 1.0))
+      return 0;
+    else if (arg[4] != ',' && arg[4] != '\0')
+      return 0;
+    cc_mode_ = CC_AIMD;
+    cc_ssthresh = ss;
+  }
+  else
+    return 0;
+  return 1;
+}
+
+int cc_mode()
+{
+  return cc_mode_;
+}
+
+int cc_log(const char *path)
+{
+  if ((cc_fp = fopen(path, "w")) == NULL) {
+    perror(path);
+    return 0;
+  }
+  fprintf(cc_fp, "# time flow cwnd ssthresh protocol\n");
+  fflush(cc_fp);               /* before a sweep forks, or every run repeats it */
+  return 1;
+}
+
+void cc_log_protocol(const char *name)
+{
+  cc_proto = name;
+}
+
+/* this flow's window is about to change from cwnd */
+cc_stats &cc_before(const congestion &c)
+{
+  unsigned f = get_flow();
+
+  if (cc_flows.size() <= f)
+    cc_flows.resize(f + 1);
+  cc_stats &s = cc_flows[f];
+  s.area += (double)c.cwnd * (get_sim_time() - s.since);
+  s.since = get_sim_time();
+  return s;
+}
+
+/* ..and has changed */
+void cc_after(const congestion &c, cc_stats &s)
+{
+  s.cwnd = c.cwnd;
+  if (c.cwnd > s.max)
+    s.max = c.cwnd;
+  if (cc_fp != NULL)
+    fprintf(cc_fp, "%f %d %f %f %s\n", get_sim_time(), get_flow(), c.cwnd, c.ssthresh, cc_proto);
+}
+
+void congestion::init()
+{
+  if (cc_mode_ == CC_NONE)
+    return;
+  cc_stats &s = cc_before(*this);
+  cwnd = 1;
+  ssthresh = cc_ssthresh > 0 ? cc_ssthresh : getwinsize();
+  cc_after(*this, s);
+}
+
+int congestion::window() const
+{
+  if (cc_mode_ == CC_NONE || cwnd >= getwinsize())
+    return getwinsize();
+  return (int)cwnd;
+}
+
+void congestion::acked(unsigned n)
+{
+  unsigned i;
+
+  if (cc_mode_ == CC_NONE || n == 0)
+    return;
+  cc_stats &s = cc_before(*this);
+  for (i = 0; i < n; i++) {
+    if (cwnd < ssthresh)
+      cwnd += 1;
+    else
+      cwnd += 1 / cwnd;
+  }
+  /* beyond -w it couldn't be used, and would take long to come down */
+  if (cwnd > getwinsize())
+    cwnd = getwinsize();
+  cc_after(*this, s);
+}
+
+void congestion::loss(seq_t base, seq_t next)
+{
+  if (cc_mode_ == CC_NONE || seq_lt(base, recover))
+    return;
+  cc_stats &s = cc_before(*this);
+  s.cuts++;
+  ssthresh = cwnd / 2 > 2 ? cwnd / 2 : 2;
+  cwnd = ssthresh;
+  recover = next;
+  cc_after(*this, s);
+}
+
+void congestion::timeout(seq_t next)
+{
+  if (cc_mode_ == CC_NONE)
+    return;
+  cc_stats &s = cc_before(*this);
+  s.timeouts++;
+  ssthresh = cwnd / 2 > 2 ? cwnd / 2 : 2;
+  cwnd = 1;
+  recover = next;
+  cc_after(*this, s);
+}
+
+void cc_report()
+{
+  float now = get_sim_time();
+  size_t i;
+
+  if (cc_fp != NULL)
+    fclose(cc_fp);
+  if (cc_mode_ == CC_NONE)
+    return;
+  printf("\nCongestion control:\n");
+  printf(" aimd, cap %d, initial ssthresh %f\n", getwinsize(),
+         cc_ssthresh > 0 ? cc_ssthresh : (float)getwinsize());
+  for (i = 0; i < cc_flows.size(); i++) {
+    cc_stats &s = cc_flows[i];
+    s.area += (double)s.cwnd * (now - s.since);
+    printf(" flow %lu: cwnd mean %f, max %f, final %f, %ld loss cut(s), %ld timeout(s)\n",
+           (unsigned long)i, now > 0 ? s.area / now : 0.0, s.max, s.cwnd, s.cuts, s.timeouts);
+  }
+}
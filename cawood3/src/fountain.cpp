@@ -0,0 +1,444 @@
+#include "../include/protocol.h"
+#include "../include/checksum.h"
+#include "../include/window.h"
+#include "../include/rto.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+/* ******************************************************************
+ FOUNTAIN CODE
+
+   A rateless code over blocks of messages, instead of ARQ:
+   - A takes up to -w messages as a block and sends symbols of it, each
+     the XOR of some of the block's payloads. The first k symbols of a
+     k-message block are the messages themselves; each after is a repair
+     symbol holding every message with probability 1/2 (a random linear
+     fountain), from a generator B can rerun from the block and symbol
+     numbers alone. Once the messages themselves are through, B lacks
+     only a few, and the sparse rows of an LT code's soliton degrees
+     mostly miss them; these dense rows decode from barely more than k
+   - B decodes by Gaussian elimination over GF(2), so any k independent
+     symbols give it the block, whichever were lost, and passes blocks
+     up in order as they decode
+   - A sends a batch of symbols sized for the loss rate it has measured.
+     The last few symbols of a batch, and every FEEDBACK_EVERYth, ask B
+     how many more it needs, and B's answers are the only feedback there
+     is: no ACK per packet, and no particular packet ever has to be
+     resent. A sends what B lacks, less what it expects of the symbols B
+     hadn't seen yet
+   - a timeout means no answer got through: A asks again with a couple
+     of new symbols per block, not a batch, since the last batch may
+     well still be queued in the channel
+   BLOCKS blocks are coded at once, so the channel is kept busy while
+   one waits for its feedback
+**********************************************************************/
+
+#define A 0
+#define B 1
+
+float TIMEOUT = 50;
+
+#define BLOCKS 2           // Blocks A has in flight
+#define FEEDBACK 0x40000000 // Set in a symbol's rcvwnd to ask for feedback
+#define FEEDBACK_MISS 0.1   // Chance, at most, that no answer to a batch gets back
+#define FEEDBACK_EVERY 8    // Symbols of a block per answer, mid-batch, so a long
+                            // batch doesn't leave A's timer without one
+#define PROBE_SYMBOLS 2     // Symbols a block gets on a timeout
+
+// A symbol is seqnum: its block; acknum: its number in the block; rcvwnd:
+// the block's size, with FEEDBACK on those that ask. B's answer
+// is seqnum: the block it is about; acknum: the next block B will pass up,
+// all before it done; rcvwnd: B's window as usual; and this in the payload
+struct feedback {
+  int need; // Independent symbols B still lacks for the block, 0 once decoded
+  int got;  // Symbols of the block B has received
+  int seen; // ..out of the first this many A sent, for the loss rate
+};
+
+// A block A is sending
+struct txBlock {
+  std::vector<msg> src;  // Its messages
+  unsigned nextId;       // Next symbol to send
+  int need;              // What B last said it needs, k until it has said
+  std::vector<float> sentAt; // When each symbol went out. None goes out twice,
+                             // so any answer gives an RTT sample
+};
+
+// A block B is decoding: rows in echelon form, row c has its lowest bit at
+// column c, and the XOR of the symbols that made it
+struct rxBlock {
+  seq_t block;
+  bool active = false;
+  bool decoded = false;
+  unsigned k;
+  unsigned words;        // 64-bit words per row
+  unsigned rank;
+  int got, seen;
+  std::vector<uint64_t> rows;  // k rows of words each
+  std::vector<msg> data;       // Each row's payload; the messages once decoded
+  ring_bitmap pivot;           // Columns with a row
+};
+
+// Per-flow state, one entry per A/B pair (see get_flow())
+struct fountainFlow {
+  // A vars
+  txBlock blocks[BLOCKS];        // Indexed by block number % BLOCKS
+  seq_t sndBase = 0;             // Oldest block B hasn't passed up
+  seq_t sndNext = 0;             // Next block to start
+  ring_queue<msg> messageBuffer; // Messages waiting for a block
+  std::vector<pkt> batch;        // Symbols going out together
+  float delivered = 1;           // Share of symbols reaching B, as B reports it
+  bool timerUsed = false;
+  int rwnd = -1;                 // Window B last advertised, -1 until its first feedback
+  rto_estimator rto;             // Our timeout, TIMEOUT unless --rto adaptive
+
+  // B vars
+  rxBlock rx[BLOCKS];            // Indexed by block number % BLOCKS
+  seq_t rcvBase = 0;             // Next block to pass up
+};
+std::vector<fountainFlow> flows;
+
+fountainFlow &thisFlow()
+{
+  // sized on first use, once the simulator knows how many flows it runs
+  if(flows.empty()) flows.resize(get_nflows());
+  return flows[get_flow()];
+}
+
+// The generator for a block's repair symbols (splitmix64), seeded so A and
+// B draw the same numbers for the same symbol
+struct symbolRng {
+  uint64_t state;
+  symbolRng(seq_t block, unsigned id) : state(((uint64_t)block << 32 | id) ^ 0x5851f42d4c957f2dULL) { }
+  uint64_t next()
+  {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+};
+
+// Which of a k-message block's messages symbol id is the XOR of, as a
+// bitmap words 64-bit words long
+void symbolRow(seq_t block, unsigned id, unsigned k, uint64_t *row, unsigned words)
+{
+  memset(row, 0, words * sizeof(uint64_t));
+  if(id < k) { // Systematic: the message itself
+    row[id >> 6] = (uint64_t)1 << (id & 63);
+    return;
+  }
+  symbolRng rng(block, id);
+  uint64_t any;
+  do { // A symbol of nothing would tell B nothing: draw again
+    any = 0;
+    for(unsigned w=0; w<words; w++) {
+      row[w] = rng.next();
+      if(w == words - 1 && k % 64 != 0) row[w] &= ((uint64_t)1 << (k % 64)) - 1;
+      any |= row[w];
+    }
+  } while(any == 0);
+}
+
+// Share of symbols getting through, kept off 0 so batches stay finite
+float delivery(fountainFlow &f)
+{
+  return f.delivered > 0.05 ? f.delivered : 0.05;
+}
+
+// Symbols to send for B to get n more independent ones, with a standard
+// deviation to spare
+unsigned batchSize(fountainFlow &f, float n)
+{
+  float p = delivery(f);
+  return (unsigned)ceil((n + sqrt(n * (1 - p))) / p);
+}
+
+// Symbols at the end of a batch of n that ask for an answer: enough that
+// one of them, and the answer, get through but for FEEDBACK_MISS
+unsigned asking(fountainFlow &f, unsigned n)
+{
+  float p = delivery(f);
+  unsigned ask = p * p < 1 - FEEDBACK_MISS ? (unsigned)ceil(log(FEEDBACK_MISS) / log(1 - p * p)) : 1;
+  return ask < n ? ask : n;
+}
+
+// Send n more symbols of block b in one call, the last ask of them asking
+// for an answer, and time them if nothing else is
+void sendSymbols(fountainFlow &f, seq_t b, unsigned n, unsigned ask)
+{
+  txBlock &t = f.blocks[b % BLOCKS];
+  unsigned k = t.src.size();
+  unsigned words = (k + 63) / 64;
+  std::vector<uint64_t> row(words);
+
+  f.batch.resize(n);
+  for(unsigned i=0; i<n; i++) {
+    unsigned id = t.nextId++;
+    struct pkt &packet = f.batch[i];
+    packet.seqnum = seq_wire(b);
+    packet.acknum = id;
+    packet.rcvwnd = k | (i + ask >= n || id % FEEDBACK_EVERY == FEEDBACK_EVERY - 1 ? FEEDBACK : 0);
+    t.sentAt.push_back(get_sim_time());
+    memset(packet.payload, 0, sizeof(packet.payload));
+    symbolRow(b, id, k, &row[0], words);
+    for(unsigned w=0; w<words; w++)
+      for(uint64_t bits=row[w]; bits; bits&=bits-1) {
+        const char *m = t.src[w * 64 + __builtin_ctzll(bits)].data;
+        for(int j=0; j<20; j++) packet.payload[j] ^= m[j];
+      }
+    packet.checksum = pkt_checksum(&packet);
+  }
+  tolayer3_batch(A, &f.batch[0], n);
+  if(!f.timerUsed) {
+    f.timerUsed = true;
+    starttimer(A, f.rto.timeout());
+  }
+}
+
+// Start blocks while there is room for one: a whole block, or whatever is
+// waiting when nothing else is in flight, so a trickle isn't held up
+void startBlocks(fountainFlow &f)
+{
+  while(f.sndNext - f.sndBase < BLOCKS && !f.messageBuffer.empty()) {
+    if(f.sndNext != f.sndBase && (int)f.messageBuffer.size() < getwinsize()) break;
+    int k = getwinsize();
+    if((int)f.messageBuffer.size() < k) k = f.messageBuffer.size();
+    if(f.rwnd >= 0 && f.rwnd < k) k = f.rwnd > 0 ? f.rwnd : 1; // B's application must fit it
+    txBlock &t = f.blocks[f.sndNext % BLOCKS];
+    t.src.clear();
+    for(int i=0; i<k; i++) t.src.push_back(f.messageBuffer.pop());
+    t.nextId = 0;
+    t.need = k;
+    t.sentAt.clear();
+    unsigned n = batchSize(f, k);
+    sendSymbols(f, f.sndNext++, n, asking(f, n));
+  }
+  setbacklog(A, f.messageBuffer.size()); // Messages waiting for a block count against --sndbuf
+}
+
+/* called from layer 5, passed the data to be sent to other side */
+void A_output(struct msg message)
+{
+  fountainFlow &f = thisFlow();
+  if(f.messageBuffer.full()) f.messageBuffer.grow(); // Only without --sndbuf
+  f.messageBuffer.push(message);
+  startBlocks(f);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 */
+void A_input(struct pkt packet)
+{
+  fountainFlow &f = thisFlow();
+  if(packet.checksum != pkt_checksum(&packet)) return;
+
+  feedback fb;
+  memcpy(&fb, packet.payload, sizeof(fb));
+  f.rwnd = packet.rcvwnd;
+  seq_t b = seq_nearest(packet.seqnum, f.sndBase);
+  bool heard = false;
+  if(b - f.sndBase < f.sndNext - f.sndBase) {
+    txBlock &t = f.blocks[b % BLOCKS];
+    if(fb.seen > 0) // B's count for the block: what reached it of what it saw
+      f.delivered = 0.75 * f.delivered + 0.25 * fb.got / fb.seen;
+    if(fb.seen > 0 && (unsigned)fb.seen <= t.nextId) // B answered symbol seen - 1
+      f.rto.sample(get_sim_time() - t.sentAt[fb.seen - 1]);
+    t.need = fb.need;
+    // Symbols sent after the last one B had seen may still make up some of
+    // what it lacks, repairs for an earlier answer included: send the rest
+    float lacking = fb.need - delivery(f) * (t.nextId - fb.seen);
+    if(fb.need > 0 && lacking > 0) {
+      count_recovery(A, RECOVERY_REPAIR);
+      unsigned n = batchSize(f, lacking + 1); // One more in case of a dependent symbol
+      sendSymbols(f, b, n, asking(f, n));
+    }
+    heard = true;
+  }
+
+  // B has passed up every block before acknum
+  seq_t acked = seq_forward(packet.acknum, f.sndBase);
+  bool moved = seq_leq(acked, f.sndNext) && acked != f.sndBase;
+  if(moved) {
+    while(f.sndBase != acked) f.blocks[f.sndBase++ % BLOCKS].src.clear();
+    f.rto.acked();
+  }
+  if(heard || moved) {
+    // B is answering: time what is still outstanding from now
+    if(f.timerUsed) stoptimer(A);
+    f.timerUsed = false;
+    if(f.sndBase != f.sndNext) {
+      f.timerUsed = true;
+      starttimer(A, f.rto.timeout());
+    }
+  }
+  if(moved) startBlocks(f);
+}
+
+/* called when A's timer goes off */
+void A_timerinterrupt()
+{
+  fountainFlow &f = thisFlow();
+  f.timerUsed = false; // our one timer has gone off, so we can use it again
+  if(f.sndBase == f.sndNext) return;
+  count_recovery(A, RECOVERY_TIMEOUT);
+  f.rto.backoff(); // Wait twice as long this time (with --rto adaptive)
+  // Ask about each block again, with a symbol or two it may still need; one
+  // B has decoded but not passed up (its application's buffer was full)
+  // needs none, but B will try again when asked
+  for(seq_t b=f.sndBase; b!=f.sndNext; b++) {
+    unsigned n = f.blocks[b % BLOCKS].need > 0 ? PROBE_SYMBOLS : 1;
+    sendSymbols(f, b, n, n);
+  }
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init()
+{
+  fountainFlow &f = thisFlow();
+  // B places a block from the BLOCKS before its next one to the BLOCKS after
+  if(getseqbits() && seq_space() < 2 * BLOCKS) {
+    fprintf(stderr, "fountain: %d blocks in flight need more than %d-bit sequence numbers\n",
+            BLOCKS, getseqbits());
+    exit(-1);
+  }
+  f.messageBuffer.reserve(getsndbuf() > 0 ? getsndbuf() + getwinsize() : getwinsize());
+  f.rto.init(TIMEOUT);
+}
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+
+// Tell A how block b is going, and which blocks B has passed up
+void sendFeedback(fountainFlow &f, seq_t b, const rxBlock *r)
+{
+  struct pkt packetACK;
+  feedback fb;
+  fb.need = r != NULL && !r->decoded ? r->k - r->rank : 0;
+  fb.got = r != NULL ? r->got : 0;
+  fb.seen = r != NULL ? r->seen : 0;
+  packetACK.seqnum = seq_wire(b);
+  packetACK.acknum = seq_wire(f.rcvBase);
+  packetACK.rcvwnd = getrcvwnd(B);
+  memset(packetACK.payload, 0, sizeof(packetACK.payload));
+  memcpy(packetACK.payload, &fb, sizeof(fb));
+  packetACK.checksum = pkt_checksum(&packetACK);
+  tolayer3(B, packetACK);
+}
+
+// Add a symbol to r's rows: reduce it by the rows it meets until it has a
+// lowest bit no row has, and keep it there. Returns false if it told B
+// nothing new
+bool addSymbol(rxBlock &r, uint64_t *row, msg &data)
+{
+  unsigned w = 0;
+  for(;;) {
+    while(w < r.words && row[w] == 0) w++;
+    if(w == r.words) return false;
+    unsigned c = w * 64 + __builtin_ctzll(row[w]);
+    uint64_t *p = &r.rows[c * r.words];
+    if(!r.pivot.test(c)) {
+      memcpy(p, row, r.words * sizeof(uint64_t));
+      r.data[c] = data;
+      r.pivot.set(c);
+      r.rank++;
+      return true;
+    }
+    for(unsigned i=w; i<r.words; i++) row[i] ^= p[i];
+    for(int j=0; j<20; j++) data.data[j] ^= r.data[c].data[j];
+  }
+}
+
+// Full rank: back-substitute, last column first, so each row's payload
+// becomes its message
+void solve(rxBlock &r)
+{
+  for(unsigned c=r.k; c-- > 0; ) {
+    uint64_t *p = &r.rows[c * r.words];
+    p[c >> 6] &= ~((uint64_t)1 << (c & 63));
+    for(unsigned w=c>>6; w<r.words; w++)
+      for(uint64_t bits=p[w]; bits; bits&=bits-1) {
+        const char *m = r.data[w * 64 + __builtin_ctzll(bits)].data;
+        for(int j=0; j<20; j++) r.data[c].data[j] ^= m[j];
+      }
+  }
+  r.decoded = true;
+}
+
+// Pass up decoded blocks in order, each once all of it fits
+void deliver(fountainFlow &f)
+{
+  for(;;) {
+    rxBlock &r = f.rx[f.rcvBase % BLOCKS];
+    if(!r.active || r.block != f.rcvBase || !r.decoded || getrcvwnd(B) < (int)r.k) return;
+    tolayer5_batch(B, r.data[0].data, r.k, sizeof(msg));
+    r.active = false;
+    f.rcvBase++;
+  }
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+void B_input(struct pkt packet)
+{
+  fountainFlow &f = thisFlow();
+  if(pkt_checksum(&packet) != packet.checksum) return;
+
+  seq_t b = seq_nearest(packet.seqnum, f.rcvBase);
+  unsigned id = packet.acknum;
+  unsigned k = packet.rcvwnd & ~FEEDBACK;
+  bool ask = packet.rcvwnd & FEEDBACK;
+  if(k == 0 || k > (unsigned)getwinsize() || packet.acknum < 0) return;
+  deliver(f); // The application may have made room since
+  if(seq_lt(b, f.rcvBase)) { // Passed up already; A hasn't heard
+    if(ask) sendFeedback(f, b, NULL);
+    return;
+  }
+  if(b - f.rcvBase >= BLOCKS) return;
+
+  rxBlock &r = f.rx[b % BLOCKS];
+  if(!r.active || r.block != b) {
+    r.block = b;
+    r.active = true;
+    r.decoded = false;
+    r.k = k;
+    r.words = (k + 63) / 64;
+    r.rank = 0;
+    r.got = r.seen = 0;
+    r.rows.assign(k * r.words, 0);
+    r.data.assign(k, msg());
+    r.pivot.reserve(k);
+  }
+  if(r.k != k) return;
+  if(!r.decoded) {
+    r.got++;
+    if((int)id >= r.seen) r.seen = id + 1;
+    std::vector<uint64_t> row(r.words);
+    msg data;
+    memcpy(data.data, packet.payload, 20);
+    symbolRow(b, id, k, &row[0], r.words);
+    if(addSymbol(r, &row[0], data) && r.rank == r.k) {
+      solve(r);
+      deliver(f);
+      sendFeedback(f, b, &r); // Decoded: A can stop
+      return;
+    }
+  }
+  if(ask) sendFeedback(f, b, &r);
+}
+
+/* called when B's timer goes off */
+void B_timerinterrupt()
+{
+}
+
+/* the following rouytine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+void B_init()
+{
+}
+
+}
+
+REGISTER_PROTOCOL("fountain")
@@ -1,8 +1,15 @@
-#include "../include/simulator.h"
+#include "../include/protocol.h"
+#include "../include/checksum.h"
+#include "../include/window.h"
+#include "../include/ackpolicy.h"
+#include "../include/rto.h"
+#include "../include/cwnd.h"
 #include <iostream>
 #include <cstring>
 #include <vector>
 
+namespace {
+
 /* ******************************************************************
  ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
 
@@ -22,68 +29,137 @@
 
 float TIMEOUT = 150;
 
-int cnt = 0;
+// Per-flow state, one entry per A/B pair (see get_flow())
+struct gbnFlow {
+  // A vars
+  int base = 0;
+  // Sent and not yet ACKd, from base() (the first frame in the window) up to
+  // next(); a ring of -w slots, each holding a buffer the channel shares
+  // while the frame is in flight
+  sliding_window<pktbuf*> window;
+  ring_queue<msg> messageBuffer; // Messages waiting for room in the window
+  seq_t sndNext = 0;             // Next packet to go out; behind next() while going back
 
-// A Global Vars
-int base = 0;
-int ASeqnumFirst = 0; // SeqNum of first frame in window
-int ASeqnumN = 0;     // SeqNum of Nth frame in window
+  bool timerUsed = false; // To ensure that we only set up one timer for GBN
+  int dupAcks = 0;        // ACKs in a row for the current base, see --dupacks
+  int rwnd = -1;          // Window B last advertised, -1 until the first ACK
+  rto_estimator rto;      // Our timeout, TIMEOUT unless --rto adaptive
+  bool timing = false;    // One packet at a time is timed for an RTT sample
+  seq_t timedSeq;         // ..this one
+  float timedAt;          // ..sent then
+  congestion cc;          // Window the channel can take, -w unless --cc aimd
 
-std::vector<msg> messageBuffer; // To store buffering messages
-std::vector<pkt> packetBuffer;  // To store N frames
+  // B vars
+  seq_t BexpectedSeq = 0;
+  delayed_ack delack;     // In-order packets B hasn't ACKd yet, see --ackevery
+};
+std::vector<gbnFlow> flows;
 
-bool timerUsed = false; // To ensure that we only set up one timer for GBN
+gbnFlow &thisFlow()
+{
+  // sized on first use, once the simulator knows how many flows it runs
+  if(flows.empty()) flows.resize(get_nflows());
+  return flows[get_flow()];
+}
 
-// B Global Vars
-int BexpectedSeq = 0;
+// Packets sent and not yet ACKd
+int inFlight(gbnFlow &f)
+{
+  return f.window.size();
+}
 
-// HELPER FUNCTIONS
-int getChecksum(struct pkt packet)
+// An ACKd packet is never resent, so let go of its buffer
+void release(pktbuf *&b)
 {
-	int checksum = packet.seqnum + packet.acknum;
-	for (int i=0; i<20; i++) {
-		checksum += packet.payload[i];
-	}
-	return checksum;
+  pktbuf_unref(b);
+  b = NULL;
 }
 
+// HELPER FUNCTIONS
 void enqueueMsg(struct msg message)
 {
-	messageBuffer.push_back(message);
+	gbnFlow &f = thisFlow();
+	if(f.messageBuffer.full()) f.messageBuffer.grow(); // Only without --sndbuf
+	f.messageBuffer.push(message);
+	setbacklog(A, f.messageBuffer.size()); // Once the buffer is full, layer 5 has to wait for room
 }
 
 msg dequeueMsg()
 {
-	struct msg message;
-	message = messageBuffer.front();
-	messageBuffer.erase(messageBuffer.begin()); // Erase first element
+	gbnFlow &f = thisFlow();
+	struct msg message = f.messageBuffer.pop();
+	setbacklog(A, f.messageBuffer.size()); // There is room in the buffer again
 
 	return message;
 }
 
+// A new message can go out: nothing is waiting to be resent and there is room
+bool canSend(gbnFlow &f)
+{
+  return f.sndNext == f.window.next() && inFlight(f) < f.cc.send_window(f.rwnd);
+}
+
+// Resend unackd packets from sndNext on, as many as the congestion window
+// allows, in one batch or two if the ring wraps
+void resend(gbnFlow &f)
+{
+  int n = f.window.next() - f.sndNext;
+  int room = f.cc.window() - (int)(f.sndNext - f.window.base());
+  if(room < n) n = room;
+  if(n <= 0) return;
+  f.window.spans(f.sndNext, n, [](pktbuf **bufs, unsigned len) {
+    tolayer3_buf_batch(A, bufs, len);
+  });
+  f.sndNext += n;
+}
+
+// Resend every unackd packet the congestion window allows now, the rest as
+// ACKs open it, and time them again
+void goBack(gbnFlow &f)
+{
+  if(f.timerUsed) stoptimer(A);
+  f.timerUsed = false;
+  f.sndNext = f.window.base();
+  resend(f);
+  if(inFlight(f) > 0) {
+    starttimer(A, f.rto.timeout());
+    f.timerUsed = true;
+  }
+  f.timing = false; // Whatever was timed has gone out twice now (Karn)
+}
+
 /* called from layer 5, passed the data to be sent to other side */
 void A_output(struct msg message)
 {
+  gbnFlow &f = thisFlow();
   // If the number of unackd packets are less than the window size
-  if(ASeqnumN - ASeqnumFirst < getwinsize()) {
-    // Construct packet
-    struct pkt packet;
-    packet.seqnum = ASeqnumN;
-    strncpy(packet.payload, message.data, sizeof(message.data));
-    packet.checksum = getChecksum(packet);
+  if(canSend(f)) {
+    // Construct packet straight into a buffer we can keep for retransmission
+    pktbuf *b = pktbuf_alloc();
+    struct pkt &packet = b->pkt;
+    packet.seqnum = seq_wire(f.window.next());
+    packet.acknum = 0; // Pooled buffers aren't zeroed
+    packet.rcvwnd = 0;
+    memcpy(packet.payload, message.data, sizeof(message.data));
+    packet.checksum = pkt_checksum(&packet);
 
     // Send to layer3, set timer if it hasnt been set
-    tolayer3(A, packet);
+    tolayer3_buf(A, b);
 		// std::cout << "Sending packet with payload: " << packet.payload;
 		// std::cout << " and seqnum " << packet.seqnum << '\n';
-    if(!timerUsed) {
-      timerUsed = true;
-      starttimer(A,TIMEOUT);
+    if(!f.timerUsed) {
+      f.timerUsed = true;
+      starttimer(A,f.rto.timeout());
+    }
+    if(!f.timing) {
+      f.timing = true;
+      f.timedSeq = f.window.next();
+      f.timedAt = get_sim_time();
     }
 
-    // Update seqnum of nth frame, and add the packet to the buffer
-    ASeqnumN++;
-    packetBuffer.push_back(packet);
+    // Take the next seqnum, keeping our reference until it's ackd
+    f.window.push() = b;
+    f.sndNext++;
   } else {
     // Buffer message if WINSIZE is full
     enqueueMsg(message);
@@ -93,70 +169,134 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4 */
 void A_input(struct pkt packet)
 {
-	if(packet.checksum == getChecksum(packet)) {
+	gbnFlow &f = thisFlow();
+	if(packet.checksum == pkt_checksum(&packet)) {
 		// If acknum for packet is in the window range
-		int ackNum = packet.acknum;
-		if(ackNum > ASeqnumFirst && ackNum < ASeqnumN) {
-			while(ASeqnumFirst <= ackNum) {
-				ASeqnumFirst++; // Move the window up to the new oldest unack'd packet
+		seq_t ackNum = seq_forward(packet.acknum, f.window.base());
+		f.rwnd = packet.rcvwnd; // Every ACK carries B's latest window
+		// B ACKs the next seqnum it expects, so everything below it has arrived.
+		// Move the window up to the new oldest unack'd packet, letting go of the ackd ones
+		unsigned moved = f.window.ack(ackNum - 1, release);
+		if(moved > 0) {
+			f.dupAcks = 0;
+			f.cc.acked(moved);
+			if(seq_lt(f.sndNext, f.window.base())) f.sndNext = f.window.base();
+			// The timed packet has been ACKd: one RTT sample
+			if(f.timing && seq_lt(f.timedSeq, f.window.base())) {
+				f.timing = false;
+				f.rto.sample(get_sim_time() - f.timedAt);
+			}
+			f.rto.acked();
+			if(f.timerUsed) stoptimer(A);
+			f.timerUsed = false;
+			// Keep timing what is still outstanding, or packets B refused are never resent
+			if(!f.window.empty()) {
+				f.timerUsed = true;
+				starttimer(A, f.rto.timeout());
+			}
+		} else if(getdupacks() > 0 && ackNum == f.window.base() && !f.window.empty()) {
+			// B is still waiting for the base; after enough of these it is lost,
+			// so go back now rather than at the timeout
+			if(++f.dupAcks == getdupacks()) {
+				count_recovery(A, RECOVERY_FAST);
+				f.cc.loss(f.window.base(), f.window.next());
+				goBack(f);
 			}
-			stoptimer(A);
 		}
+		// Resend what going back left for later, then move buffered messages
+		// into the window space that just opened
+		resend(f);
+		while(!f.messageBuffer.empty() && canSend(f))
+			A_output(dequeueMsg());
 	}
 }
 
 /* called when A's timer goes off */
 void A_timerinterrupt()
 {
-  timerUsed =  false; // our one timer has gone off, so we can use it again
-  int i = ASeqnumFirst; // point to oldest unackd packet;
-  for(i; i<ASeqnumN-1; i++) {
-    pkt toSend = packetBuffer[i]; // grab packet
-    tolayer3(A, toSend);
-    if(!timerUsed) {
-      starttimer(A, TIMEOUT);
-      timerUsed = true;
-    }
-  }
+  gbnFlow &f = thisFlow();
+  f.timerUsed =  false; // our one timer has gone off, so we can use it again
+  if(inFlight(f) > 0) count_recovery(A, RECOVERY_TIMEOUT);
+  f.rto.backoff(); // Wait twice as long this time (with --rto adaptive)
+  f.cc.timeout(f.window.next()); // Back to one packet (with --cc aimd)
+  goBack(f);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
 void A_init()
 {
+  gbnFlow &f = thisFlow();
+  // The ACK for a full window must not look like the ACK before it
+  seq_check_window("gbn", seq_space() - 1);
+  f.window.reserve(getwinsize());
+  f.messageBuffer.reserve(getsndbuf() > 0 ? getsndbuf() : getwinsize());
+  f.rto.init(TIMEOUT);
+  f.cc.init();
 }
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
 
+// ACK everything B has in order so far, with the window it has now
+void sendAck(gbnFlow &f)
+{
+	struct pkt packetACK = {};
+	packetACK.acknum = seq_wire(f.BexpectedSeq);
+	packetACK.rcvwnd = getrcvwnd(B);
+	packetACK.checksum = pkt_checksum(&packetACK);
+	tolayer3(B,packetACK);
+	f.delack.sent(); // It covers anything B was holding
+}
+
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 void B_input(struct pkt packet)
 {
-	// if(cnt++ > 20) return;
-	// if(cnt++ > 100) return; 
-	int checksum = getChecksum(packet);
-	int seqnum = packet.seqnum;
+	gbnFlow &f = thisFlow();
+	int checksum = pkt_checksum(&packet);
+	int seqnum = packet.seqnum; // Only the low --seqbits bits of the count
 	// std::cout << "Received packet with payload " << packet.payload;
 	// std::cout << " and seqnum " << packet.seqnum;
 	// std::cout << " and we are expecting seqnum " << BexpectedSeq << '\n';
 	// If packet isn't corrupted and is the expected sequence number..
-	if(checksum == packet.checksum && seqnum == BexpectedSeq) {
-		BexpectedSeq++; // Update B's expected sequence number for the next packet
+	if(checksum == packet.checksum && seqnum == seq_wire(f.BexpectedSeq)) {
+		// Only take the packet if the app layer has room for it; otherwise
+		// A resends it and we ACK the same number with the window we have
+		if(getrcvwnd(B) > 0) {
+			f.BexpectedSeq++; // Update B's expected sequence number for the next packet
 
-		// Send payload over to app layer
-		tolayer5(B, packet.payload);
+			// Send payload over to app layer
+			tolayer5(B, packet.payload);
 
-		// Create ack
-		struct pkt packetACK;
-		packetACK.acknum = BexpectedSeq;
-		packetACK.checksum = getChecksum(packetACK);
+			// The ACK may wait for more packets, see --ackevery/--ackdelay
+			if(!f.delack.arrived()) return;
+		}
 
 		// Send ack to A
-		tolayer3(B,packetACK);
+		sendAck(f);
+	} else if(checksum == packet.checksum) {
+		// Out of order or a duplicate: ACK the last in-order packet again.
+		// If every ACK for a window was lost, this is the only way A learns
+		// that B has it all; with --dupacks A can also go back before its
+		// timer runs out. Under --cc A goes back one packet at a time, which
+		// may be one we already have
+		sendAck(f);
 	}
 }
 
+/* called when B's timer goes off */
+void B_timerinterrupt()
+{
+	gbnFlow &f = thisFlow();
+	// Packets have waited --ackdelay for their ACK
+	if(f.delack.expired()) sendAck(f);
+}
+
 /* the following rouytine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init()
 {
 }
+
+}
+
+REGISTER_PROTOCOL("gbn")
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "../include/pacer.h"
+
+/*****************************************************************
+ Token-bucket pacing.  The simulator keeps each flow's pacer
+ queue and schedules its releases; this file keeps the buckets,
+ estimates --pace auto's rate from ACK arrivals, and measures
+ the bursts A puts on the wire, paced or not.
+******************************************************************/
+
+int pace_mode_ = PACE_OFF;
+int pace_given = 0;            /* --pace was given: measure and report */
+float pace_rate = 0;           /* --pace rate, packets per time unit */
+float pace_burst = 1;          /* bucket depth, packets */
+
+struct pace_flow {
+  /* the bucket */
+  float rate = 0;              /* 0 until --pace auto has an estimate */
+  float tokens = 0;
+  float filled = 0;            /* tokens are as of this time */
+  /* --pace auto */
+  long acks = 0;
+  float ackat[PACE_SPAN] = {};      /* arrival times of the last PACE_SPAN ACKs */
+  float samples[PACE_SAMPLES] = {}; /* the last ACK rates measured, 0 for none */
+  /* statistics */
+  float burst_at = -1;         /* time of the burst being counted */
+  int burst = 0;               /* ..and its packets so far */
+  std::vector<int> bursts;
+  long sent = 0;
+  long held = 0;               /* packets that waited for a token */
+  double waits = 0.0;
+  float maxwait = 0;
+  int maxq = 0;
+  long absorbed = 0;           /* resends of a packet still queued */
+  long drops = 0;
+};
+std::vector<pace_flow> pace_flows;
+
+int pace_set(const char *arg)
+{
+  const char *rest;
+  float burst = 1;
+
+  if (strcmp(arg, "off") == 0) {
+    pace_mode_ = PACE_OFF;
+    pace_given = 1;
+    return 1;
+  }
+  if (strncmp(arg, "auto", 4) == 0) {
+    rest = arg + 4;
+    pace_mode_ = PACE_AUTO;
+  }
+  else {
+    pace_rate = strtod(arg, (char **)&rest);
+    if (rest == arg || pace_rate <= 0.0)
+      return 0;
+    pace_mode_ = PACE_RATE;
+  }
+  if (*rest == ',' && (sscanf(rest + 1, "%f", &burst) != 1 || burst < 1.0))
+    return 0;
+  else if (*rest != ',' && *rest != '\0')
+    return 0;
+  pace_burst = burst;
+  pace_given = 1;
+  return 1;
+}
+
+int pace_mode()
+{
+  return pace_mode_;
+}
+
+void pace_init(int nflows)
+{
+  int i;
+
+  pace_flows.assign(nflows, pace_flow());
+  for (i = 0; i < nflows; i++) {
+    pace_flows[i].rate = pace_mode_ == PACE_RATE ? pace_rate : 0;
+    pace_flows[i].tokens = pace_burst;   /* a full bucket to start */
+  }
+}
+
+/* bring p's tokens up to now */
+void pace_fill(pace_flow &p, float now)
+{
+  p.tokens += p.rate * (now - p.filled);
+  if (p.tokens > pace_burst)
+    p.tokens = pace_burst;
+  p.filled = now;
+}
+
+int pace_take(int f, float now, int due)
+{
+  pace_flow &p = pace_flows[f];
+
+  if (pace_mode_ == PACE_OFF || p.rate == 0)
+    return 1;
+  pace_fill(p, now);
+  if (p.tokens < 1 && !due)
+    return 0;
+  p.tokens -= 1;               /* a due token may leave a little debt */
+  return 1;
+}
+
+float pace_due(int f, float now)
+{
+  pace_flow &p = pace_flows[f];
+
+  if (p.rate == 0 || p.tokens >= 1)
+    return now;
+  return now + (1 - p.tokens) / p.rate;
+}
+
+void pace_ack(int f, float now)
+{
+  pace_flow &p = pace_flows[f];
+  float span, best;
+  int i;
+
+  if (pace_mode_ != PACE_AUTO)
+    return;
+  /* ackat[] holds the ACK PACE_SPAN back in the slot this one takes */
+  i = p.acks % PACE_SPAN;
+  span = now - p.ackat[i];
+  p.ackat[i] = now;
+  if (p.acks++ < PACE_SPAN || span <= 0)
+    return;
+  p.samples[p.acks % PACE_SAMPLES] = PACE_SPAN / span;
+  for (best = 0, i = 0; i < PACE_SAMPLES; i++)
+    if (p.samples[i] > best)
+      best = p.samples[i];
+  pace_fill(p, now);           /* tokens so far came at the old rate */
+  p.rate = PACE_GAIN * best;
+}
+
+void pace_sent(int f, float now, float wait)
+{
+  pace_flow &p = pace_flows[f];
+
+  if (!pace_given)
+    return;
+  p.sent++;
+  if (wait > 0) {
+    p.held++;
+    p.waits += wait;
+    if (wait > p.maxwait)
+      p.maxwait = wait;
+  }
+  /* packets that reach the channel at the same instant are one burst */
+  if (now != p.burst_at) {
+    if (p.burst > 0)
+      p.bursts.push_back(p.burst);
+    p.burst_at = now;
+    p.burst = 0;
+  }
+  p.burst++;
+}
+
+void pace_queued(int f, int len)
+{
+  if (len > pace_flows[f].maxq)
+    pace_flows[f].maxq = len;
+}
+
+void pace_absorbed(int f)
+{
+  pace_flows[f].absorbed++;
+}
+
+void pace_dropped(int f)
+{
+  pace_flows[f].drops++;
+}
+
+void pace_report()
+{
+  size_t i, j, n;
+  double sum;
+
+  if (!pace_given)
+    return;
+  printf("\nPacing statistics:\n");
+  if (pace_mode_ == PACE_OFF)
+    printf(" pacer: off, measuring only\n");
+  else if (pace_mode_ == PACE_AUTO)
+    printf(" pacer: auto, %f x ACK rate, burst %f\n", PACE_GAIN, pace_burst);
+  else
+    printf(" pacer: rate %f, burst %f\n", pace_rate, pace_burst);
+  for (i = 0; i < pace_flows.size(); i++) {
+    pace_flow &p = pace_flows[i];
+    std::vector<int> &b = p.bursts;
+    if (p.burst > 0)
+      b.push_back(p.burst);
+    p.burst = 0;
+    printf(" flow %lu: %ld packets, %ld dropped at the bottleneck\n",
+           (unsigned long)i, p.sent, p.drops);
+    if ((n = b.size()) > 0) {
+      std::sort(b.begin(), b.end());
+      for (sum = 0.0, j = 0; j < n; j++)
+        sum += b[j];
+      printf("  bursts: n %lu, mean %f, p50 %d, p90 %d, p99 %d, max %d\n",
+             (unsigned long)n, sum / n, b[n/2], b[n*9/10], b[n*99/100], b[n-1]);
+    }
+    if (pace_mode_ != PACE_OFF)
+      printf("  held %ld, mean wait %f, max wait %f, max queue %d, resends absorbed %ld, rate %f\n",
+             p.held, p.held > 0 ? p.waits / p.held : 0.0, p.maxwait, p.maxq, p.absorbed, p.rate);
+  }
+}
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+
+#include "../include/simulator.h"
+
+/*****************************************************************
+ Packet buffers.  A transport that keeps a packet for retransmission
+ and the channel carrying it share one buffer, each holding a
+ reference; whoever lets go last returns it to the pool.  Buffers
+ are carved from the heap in blocks and recycled through a free
+ list, so steady-state sending allocates nothing.
+******************************************************************/
+
+#define  PKTBUF_BLOCK  256
+
+struct pktbuf *pb_free = NULL;
+
+struct pktbuf *pktbuf_alloc()
+{
+  struct pktbuf *b;
+  int i;
+
+  if (pb_free == NULL) {
+    b = (struct pktbuf *)malloc(PKTBUF_BLOCK * sizeof(struct pktbuf));
+    for (i = 0; i < PKTBUF_BLOCK; i++) {
+      b[i].next = pb_free;
+      pb_free = &b[i];
+    }
+  }
+  b = pb_free;
+  pb_free = b->next;
+  b->refs = 1;
+  return b;
+}
+
+struct pktbuf *pktbuf_ref(struct pktbuf *b)
+{
+  b->refs++;
+  return b;
+}
+
+void pktbuf_unref(struct pktbuf *b)
+{
+  if (--b->refs > 0)
+    return;
+  b->next = pb_free;
+  pb_free = b;
+}
+
+/* give the holder of *bp a buffer nobody else sees, copying it first */
+/* if it is shared, and return the packet it may now modify           */
+struct pkt *pktbuf_unshare(struct pktbuf **bp)
+{
+  struct pktbuf *b = *bp;
+
+  if (b->refs > 1) {
+    *bp = pktbuf_alloc();
+    (*bp)->pkt = b->pkt;
+    pktbuf_unref(b);
+  }
+  return &(*bp)->pkt;
+}
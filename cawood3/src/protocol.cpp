@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/protocol.h"
+
+/*****************************************************************
+ Protocol registry.  Each protocol file registers itself from a
+ static constructor, before main() runs, so the list is a plain
+ linked list of entries the registrars own; nothing is allocated.
+******************************************************************/
+
+struct protocol_entry *pr_list = NULL;
+
+void register_protocol(struct protocol_entry *p)
+{
+  struct protocol_entry **pp;
+
+  for (pp = &pr_list; *pp != NULL && strcmp((*pp)->name, p->name) < 0; pp = &(*pp)->next)
+    ;
+  p->next = *pp;
+  *pp = p;
+}
+
+struct protocol_entry *protocol_list()
+{
+  return pr_list;
+}
+
+struct protocol_entry *find_protocol(const char *name)
+{
+  struct protocol_entry *p;
+
+  for (p = pr_list; p != NULL; p = p->next)
+    if (strcmp(p->name, name) == 0)
+      return p;
+  return NULL;
+}
+
+int select_protocols(const char *arg)
+{
+  struct protocol_entry *p;
+  char *list, *name;
+  int n = 0;
+
+  if (strcmp(arg, "all") == 0) {
+    for (p = pr_list; p != NULL; p = p->next, n++)
+      p->selected = 1;
+    return n;
+  }
+  list = strdup(arg);
+  for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    if ((p = find_protocol(name)) == NULL) {
+      fprintf(stderr, "Unknown protocol %s; linked in:", name);
+      list_protocols(stderr);
+      free(list);
+      return 0;
+    }
+    if (!p->selected)
+      n++;
+    p->selected = 1;
+  }
+  free(list);
+  return n;
+}
+
+void list_protocols(FILE *fp)
+{
+  struct protocol_entry *p;
+
+  for (p = pr_list; p != NULL; p = p->next)
+    fprintf(fp, " %s", p->name);
+  fprintf(fp, "\n");
+}
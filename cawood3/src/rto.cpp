@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../include/rto.h"
+
+/*****************************************************************
+ Retransmission timeout estimation.  The estimator itself is a
+ few lines of RFC 6298; most of this file collects what it saw so
+ the run can report it.  Samples and timeouts are summed as they
+ come, and binned in a fixed log-scale histogram for percentiles,
+ so a long run costs no more memory than a short one.
+******************************************************************/
+
+int rto_mode_ = RTO_FIXED;
+int rto_given = 0;             /* --rto was given: report at the end */
+float rto_min = 1.0;
+float rto_max = 1000.0;
+
+/* a series' n, sum, min and max, and a histogram of DIST_STEPS bins per */
+/* power of two from 2^DIST_LOG2_MIN to 2^DIST_LOG2_MAX, so percentiles  */
+/* come out within about 2%.  Values outside it go in the end bins.      */
+#define DIST_LOG2_MIN  -8
+#define DIST_LOG2_MAX  24
+#define DIST_STEPS     16
+#define DIST_BINS      ((DIST_LOG2_MAX - DIST_LOG2_MIN) * DIST_STEPS)
+
+struct dist {
+  long n;
+  double sum;
+  float min, max;
+  long bin[DIST_BINS];
+};
+
+/* statistics */
+struct dist rto_rtts;          /* RTT samples */
+struct dist rto_used;          /* timeouts a sender armed */
+long rto_backoffs = 0;
+
+void dist_add(struct dist *d, float x)
+{
+  int b = x > 0 ? (int)floor((log2(x) - DIST_LOG2_MIN) * DIST_STEPS) : 0;
+
+  if (d->n == 0 || x < d->min)
+    d->min = x;
+  if (d->n == 0 || x > d->max)
+    d->max = x;
+  d->n++;
+  d->sum += x;
+  if (b < 0)
+    b = 0;
+  if (b >= DIST_BINS)
+    b = DIST_BINS - 1;
+  d->bin[b]++;
+}
+
+/* the i-th smallest value (from 0), as the middle of its bin, kept */
+/* within min and max                                                */
+float dist_at(const struct dist *d, long i)
+{
+  long seen = 0;
+  int b;
+  float x;
+
+  for (b = 0; b < DIST_BINS - 1; b++) {
+    seen += d->bin[b];
+    if (seen > i)
+      break;
+  }
+  x = exp2(DIST_LOG2_MIN + (b + 0.5) / DIST_STEPS);
+  if (x < d->min)
+    x = d->min;
+  if (x > d->max)
+    x = d->max;
+  return x;
+}
+
+int rto_set(const char *arg)
+{
+  float lo = 1.0, hi = 1000.0;
+
+  if (strcmp(arg, "fixed") == 0)
+    rto_mode_ = RTO_FIXED;
+  else if (strncmp(arg, "adaptive", 8) == 0) {
+    if (arg[8] == ',' && sscanf(arg + 9, "%f,%f", &lo, &hi) < 1)
+      return 0;
+    else if (arg[8] != ',' && arg[8] != '\0')
+      return 0;
+    if (lo <= 0.0 || hi < lo)
+      return 0;
+    rto_mode_ = RTO_ADAPTIVE;
+    rto_min = lo;
+    rto_max = hi;
+  }
+  else
+    return 0;
+  rto_given = 1;
+  return 1;
+}
+
+int rto_mode()
+{
+  return rto_mode_;
+}
+
+void rto_estimator::init(float timeout)
+{
+  fixed = timeout;
+  rto = timeout;
+  measured = false;
+}
+
+float rto_estimator::current() const
+{
+  return rto_mode_ == RTO_ADAPTIVE ? rto : fixed;
+}
+
+float rto_estimator::timeout()
+{
+  float t = current();
+
+  if (rto_given)
+    dist_add(&rto_used, t);
+  return t;
+}
+
+void rto_estimator::sample(float rtt)
+{
+  float err;
+
+  if (rto_given)
+    dist_add(&rto_rtts, rtt);
+  if (!measured) {
+    srtt = rtt;
+    rttvar = rtt / 2;
+    measured = true;
+  }
+  else {
+    err = srtt - rtt;
+    rttvar = 0.75 * rttvar + 0.25 * (err < 0 ? -err : err);
+    srtt = 0.875 * srtt + 0.125 * rtt;
+  }
+  acked();
+}
+
+void rto_estimator::acked()
+{
+  if (!measured)
+    return;                    /* still TIMEOUT, backed off or not */
+  rto = srtt + 4 * rttvar;
+  if (rto < rto_min)
+    rto = rto_min;
+  if (rto > rto_max)
+    rto = rto_max;
+}
+
+void rto_estimator::backoff()
+{
+  rto_backoffs++;
+  rto = 2 * rto < rto_max ? 2 * rto : rto_max;
+}
+
+/* n, mean and a few percentiles of d */
+void print_dist(const char *what, const struct dist *d)
+{
+  long n = d->n;
+
+  if (n == 0) {
+    printf(" %s: none\n", what);
+    return;
+  }
+  printf(" %s: n %ld, mean %f, min %f, p50 %f, p90 %f, p99 %f, max %f\n",
+         what, n, d->sum / n, d->min, dist_at(d, n/2), dist_at(d, n*9/10),
+         dist_at(d, n*99/100), d->max);
+}
+
+void rto_report()
+{
+  if (!rto_given)
+    return;
+  printf("\nRTO statistics:\n");
+  if (rto_mode_ == RTO_ADAPTIVE)
+    printf(" adaptive, within [%f, %f], %ld backoff(s)\n", rto_min, rto_max, rto_backoffs);
+  else
+    printf(" fixed, %ld timeout(s)\n", rto_backoffs);
+  print_dist("RTT samples", &rto_rtts);
+  print_dist("timeouts armed", &rto_used);
+}
@@ -0,0 +1,337 @@
+#include "../include/protocol.h"
+#include "../include/checksum.h"
+#include "../include/window.h"
+#include "../include/ackpolicy.h"
+#include "../include/rto.h"
+#include "../include/cwnd.h"
+#include <cstring>
+#include <vector>
+
+namespace {
+
+/* ******************************************************************
+ SELECTIVE ACKNOWLEDGMENT (SACK)
+
+   Go-Back-N's cumulative ACKs, with the receiver's out-of-order
+   packets listed in every ACK so the sender resends only the holes:
+   - B buffers out-of-order packets like SR and ACKs the next seqnum
+     it expects, as GBN does, with up to SACK_BLOCKS ranges of what
+     it holds beyond it in the ACK's payload
+   - A's base moves on the cumulative ACK alone. The channel never
+     reorders, so a packet B hasn't got is lost once B SACKs one sent
+     after it; A resends it straight away
+   - on a timeout A resends the base and any holes before the last
+     packet B has SACKd, not the whole window
+**********************************************************************/
+
+#define A 0
+#define B 1
+
+float TIMEOUT = 50;
+
+// SACK blocks ride in the payload, which an ACK doesn't otherwise use:
+// [start, end) ranges B holds, as offsets from acknum. A block with
+// end 0 ends the list
+#define SACK_BLOCKS 5
+struct sackBlock {
+  unsigned short start, end;
+};
+
+// A packet A has sent and B hasn't cumulatively ACKd
+struct sackSlot {
+  pktbuf *buf;     // Shared with the channel while in flight
+  unsigned order;  // Its place among all of A's sends, the latest time it went out
+  float firstSent; // For an RTT sample
+  bool resent;     // Went out more than once, so its ACK is no sample (Karn)
+};
+
+// A payload B holds until everything before it has arrived
+struct rcvSlot {
+  char payload[20];
+};
+
+// Per-flow state, one entry per A/B pair (see get_flow())
+struct sackFlow {
+  // A vars
+  // Sent and not yet cumulatively ACKd, from base() up to next(); the
+  // window's ack bitmap marks the packets B has SACKd
+  sliding_window<sackSlot> window;
+  ring_queue<msg> messageBuffer;   // Messages waiting for room in the window
+  std::vector<pktbuf*> batch;      // Packets going out together
+  unsigned sends = 0;              // Packets sent so far, to put them in order
+  unsigned highSack = 0;           // Latest order among the packets B has SACKd, 0 for none
+  bool timerUsed = false;
+  int rwnd = -1;                   // Window B last advertised, -1 until the first ACK
+  rto_estimator rto;               // Our timeout, TIMEOUT unless --rto adaptive
+  congestion cc;                   // Window the channel can take, -w unless --cc aimd
+
+  // B vars
+  receive_window<rcvSlot> recvWindow; // Out-of-order payloads, from the next seqnum B expects
+  delayed_ack delack;                 // In-order packets B hasn't ACKd yet, see --ackevery
+};
+std::vector<sackFlow> flows;
+
+sackFlow &thisFlow()
+{
+  // sized on first use, once the simulator knows how many flows it runs
+  if(flows.empty()) flows.resize(get_nflows());
+  return flows[get_flow()];
+}
+
+// Cumulatively ACKd, so never resent: let go of its buffer
+void release(sackSlot &p)
+{
+  pktbuf_unref(p.buf);
+  p.buf = NULL;
+}
+
+// Queue packet seq to go out with the next flush()
+void send(sackFlow &f, seq_t seq)
+{
+  f.window[seq].order = ++f.sends;
+  f.batch.push_back(f.window[seq].buf);
+}
+
+// Send everything queued in one call, and time it if nothing else is
+void flush(sackFlow &f)
+{
+  if(f.batch.empty()) return;
+  tolayer3_buf_batch(A, &f.batch[0], f.batch.size());
+  f.batch.clear();
+  if(!f.timerUsed) {
+    f.timerUsed = true;
+    starttimer(A, f.rto.timeout());
+  }
+}
+
+// Move buffered messages into whatever room the window has
+void sendNew(sackFlow &f)
+{
+  while(!f.messageBuffer.empty() && (int)f.window.size() < f.cc.send_window(f.rwnd)) {
+    msg m = f.messageBuffer.pop();
+    seq_t seq = f.window.next();
+    sackSlot &p = f.window.push();
+    p.buf = pktbuf_alloc();
+    struct pkt &packet = p.buf->pkt;
+    packet.seqnum = seq_wire(seq);
+    packet.acknum = 0; // Pooled buffers aren't zeroed
+    packet.rcvwnd = 0;
+    memcpy(packet.payload, m.data, sizeof(m.data));
+    packet.checksum = pkt_checksum(&packet);
+    p.firstSent = get_sim_time();
+    p.resent = false;
+    send(f, seq);
+  }
+  flush(f);
+  // Messages beyond -w count against --sndbuf
+  setbacklog(A, (int)(f.window.size() + f.messageBuffer.size()) - getwinsize());
+}
+
+/* called from layer 5, passed the data to be sent to other side */
+void A_output(struct msg message)
+{
+  sackFlow &f = thisFlow();
+  if(f.messageBuffer.full()) f.messageBuffer.grow(); // Only without --sndbuf
+  f.messageBuffer.push(message); // Queue behind anything already waiting
+  sendNew(f);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 */
+void A_input(struct pkt packet)
+{
+  sackFlow &f = thisFlow();
+  if(packet.checksum != pkt_checksum(&packet)) return;
+
+  // B ACKs the next seqnum it expects, so everything below it has arrived
+  seq_t ackNum = seq_forward(packet.acknum, f.window.base());
+  f.rwnd = packet.rcvwnd; // Every ACK carries B's latest window
+  // The newest packet ACKd gives a sample only if nothing it covers was resent:
+  // when a resend fills a hole below it, the ACK waited for the repair (Karn)
+  bool once = f.window.outstanding(ackNum - 1);
+  for(seq_t s=f.window.base(); once && s!=ackNum; s++)
+    if(f.window[s].resent) once = false;
+  if(once) f.rto.sample(get_sim_time() - f.window[ackNum - 1].firstSent);
+  unsigned moved = f.window.ack(ackNum - 1, release);
+  if(moved > 0) {
+    f.rto.acked();
+    f.cc.acked(moved);
+    // Time what is still outstanding from now
+    if(f.timerUsed) stoptimer(A);
+    f.timerUsed = false;
+    if(!f.window.empty()) {
+      f.timerUsed = true;
+      starttimer(A, f.rto.timeout());
+    }
+  }
+
+  // Mark what B holds past it
+  sackBlock blocks[SACK_BLOCKS];
+  memcpy(blocks, packet.payload, sizeof(blocks));
+  for(int i=0; i<SACK_BLOCKS && blocks[i].end != 0; i++) {
+    for(seq_t s=ackNum+blocks[i].start; s!=ackNum+blocks[i].end; s++) {
+      if(!f.window.outstanding(s) || f.window.acked(s)) continue;
+      f.window.mark(s);
+      if(seq_lt(f.highSack, f.window[s].order)) f.highSack = f.window[s].order;
+    }
+  }
+
+  // Anything B hasn't got that went out before a packet it has is lost; the
+  // rest of what B hasn't got is still in flight
+  int lost = 0, pipe = 0;
+  for(seq_t s=f.window.base(); s!=f.window.next(); s++) {
+    if(f.window.acked(s)) continue;
+    if(seq_lt(f.window[s].order, f.highSack)) lost++;
+    else pipe++;
+  }
+  if(lost > 0) f.cc.loss(f.window.base(), f.window.next()); // Halve the window (with --cc aimd)
+
+  // Resend the lost ones, once each until B SACKs something sent after the
+  // resend, as far as the send window has room beside what is in flight
+  int room = f.cc.send_window(f.rwnd) - pipe, holes = 0;
+  for(seq_t s=f.window.base(); s!=f.window.next() && holes<room; s++) {
+    if(!f.window.acked(s) && seq_lt(f.window[s].order, f.highSack)) {
+      f.window[s].resent = true;
+      send(f, s);
+      holes++;
+    }
+  }
+  if(holes > 0) count_recovery(A, RECOVERY_FAST);
+  flush(f);
+
+  sendNew(f); // The window may have moved or grown
+}
+
+/* called when A's timer goes off */
+void A_timerinterrupt()
+{
+  sackFlow &f = thisFlow();
+  f.timerUsed = false; // our one timer has gone off, so we can use it again
+  if(f.window.empty()) return;
+  count_recovery(A, RECOVERY_TIMEOUT);
+  f.rto.backoff(); // Wait twice as long this time (with --rto adaptive)
+  f.cc.timeout(f.window.next()); // Back to one packet (with --cc aimd)
+  // Resend the base and the holes below the last packet B has SACKd, as
+  // many as the shrunken send window allows, and time them again. Resending
+  // the whole window every timeout would queue more than the channel drains
+  // between timeouts
+  seq_t last = f.window.base();
+  for(seq_t s=f.window.base(); s!=f.window.next(); s++)
+    if(f.window.acked(s)) last = s;
+  int room = f.cc.send_window(f.rwnd), holes = 0;
+  for(seq_t s=f.window.base(); (s==f.window.base() || seq_lt(s, last)) && holes<room; s++) {
+    if(!f.window.acked(s)) {
+      f.window[s].resent = true;
+      send(f, s);
+      holes++;
+    }
+  }
+  flush(f);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init()
+{
+  sackFlow &f = thisFlow();
+  // B buffers out of order like SR, so it must tell a packet a window
+  // ahead of its base from one a window behind
+  seq_check_window("sack", seq_space() / 2);
+  f.window.reserve(getwinsize());
+  f.messageBuffer.reserve(getsndbuf() > 0 ? getsndbuf() + getwinsize() : getwinsize());
+  f.rto.init(TIMEOUT);
+  f.cc.init();
+}
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+
+// ACK the next seqnum B expects, with the ranges it holds beyond it. The
+// range holding latest, the packet that just arrived, goes first so A hears
+// about it even when there are more ranges than fit (RFC 2018)
+void sendAck(sackFlow &f, seq_t latest)
+{
+  receive_window<rcvSlot> &w = f.recvWindow;
+  seq_t base = w.base();
+  sackBlock blocks[SACK_BLOCKS];
+  int n = 0;
+
+  memset(blocks, 0, sizeof(blocks));
+  if(latest - base < w.capacity() && w.have(latest)) {
+    seq_t start = latest, end = latest + 1;
+    while(start - 1 != base && w.have(start - 1)) start--;
+    while(end - base < w.capacity() && w.have(end)) end++;
+    blocks[n].start = start - base;
+    blocks[n].end = end - base;
+    n++;
+  }
+  for(seq_t s=base+1; n<SACK_BLOCKS && s-base<w.capacity() && s-base<=0xffff; s++) {
+    if(!w.have(s) || w.have(s - 1)) continue;
+    seq_t end = s + 1;
+    while(end - base < w.capacity() && w.have(end)) end++;
+    if(end - base > 0xffff) break;
+    if(n == 0 || blocks[0].start != s - base) {
+      blocks[n].start = s - base;
+      blocks[n].end = end - base;
+      n++;
+    }
+    s = end - 1;
+  }
+
+  struct pkt packetACK;
+  packetACK.seqnum = 0;
+  packetACK.acknum = seq_wire(base);
+  packetACK.rcvwnd = getrcvwnd(B);
+  memcpy(packetACK.payload, blocks, sizeof(blocks));
+  packetACK.checksum = pkt_checksum(&packetACK);
+  tolayer3(B, packetACK);
+  f.delack.sent(); // It covers anything B was holding
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+void B_input(struct pkt packet)
+{
+  sackFlow &f = thisFlow();
+  if(pkt_checksum(&packet) != packet.checksum) return;
+
+  seq_t base = f.recvWindow.base();
+  seq_t seq = seq_nearest(packet.seqnum, base);
+  // Anything beyond base + getrcvwnd(B) might not fit in the app layer once
+  // delivered, so it isn't kept; the ACK tells A the window we have
+  if(f.recvWindow.in_window(seq) && seq - base < (seq_t)getrcvwnd(B)) {
+    if(!f.recvWindow.have(seq))
+      memcpy(f.recvWindow.put(seq).payload, packet.payload, 20);
+    if(seq == base) {
+      // Send it up along with every consecutive packet buffered behind it,
+      // straight out of their slots
+      unsigned n = f.recvWindow.ready();
+      f.recvWindow.spans(base, n, [](rcvSlot *slots, unsigned len) {
+        tolayer5_batch(B, slots[0].payload, len, sizeof(rcvSlot));
+      });
+      f.recvWindow.deliver(n);
+      // A packet that fills a gap is ACKd at once, one in order may wait
+      if(n == 1 && !f.delack.arrived()) return;
+    }
+  }
+  // Out of order, a duplicate or refused: A should hear about it now
+  sendAck(f, seq);
+}
+
+/* called when B's timer goes off */
+void B_timerinterrupt()
+{
+  sackFlow &f = thisFlow();
+  // Packets have waited --ackdelay for their ACK
+  if(f.delack.expired()) sendAck(f, f.recvWindow.base());
+}
+
+/* the following rouytine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+void B_init()
+{
+  sackFlow &f = thisFlow();
+  // One slot per seqnum B can accept ahead of the one it expects
+  f.recvWindow.reserve(getwinsize());
+}
+
+}
+
+REGISTER_PROTOCOL("sack")
@@ -3,8 +3,22 @@
 #include <getopt.h>
 #include <ctype.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <deque>
 
 #include "../include/simulator.h"
+#include "../include/protocol.h"
+#include "../include/channel.h"
+#include "../include/topology.h"
+#include "../include/traffic.h"
+#include "../include/transfer.h"
+#include "../include/checksum.h"
+#include "../include/rto.h"
+#include "../include/cwnd.h"
+#include "../include/pacer.h"
 
 /* Statistics */
 int A_application = 0;
@@ -13,6 +27,13 @@ int B_application = 0;
 int B_transport = 0;
 
 int win_size;
+int seq_bits = 0;          /* --seqbits, 0 for full-width sequence numbers */
+int dupacks = 0;           /* --dupacks, 0 for no fast retransmit */
+int nrecover[3];           /* recoveries by timeout, duplicate ACKs and feedback */
+int ackevery = 0;          /* --ackevery, 0 if not set */
+float ackdelay = 0.0;      /* --ackdelay, 0 if not set */
+int B_acks = 0;            /* packets B sent into layer 3 */
+int nacktimer = 0;         /* times B's timer went off */
 
 int TRACE = 1;             /* for my debugging */
 int nsim = 0;              /* number of messages from 5 to 4 so far */
@@ -21,9 +42,24 @@ float time_local = 0;
 float lossprob;            /* probability that a packet is dropped  */
 float corruptprob;         /* probability that one bit is packet is flipped */
 float lambda;              /* arrival rate of messages from layer 5 */
-int   ntolayer3;           /* number sent into layer 3 */
+long  ntolayer3;           /* number sent into layer 3; long, as it can pass 2^31 */
 int   nlost;               /* number lost in media */
 int ncorrupt;              /* number corrupted by media*/
+float until = 0.0;         /* stop the run at this time, 0 for no limit */
+int narrivals = 0;         /* layer 5 arrivals scheduled so far */
+int pending_arrivals = 0;  /* layer 5 arrivals still on the event list */
+int sndbuf = 0;            /* messages a sender may buffer, 0 for unlimited */
+int nheld = 0;             /* flows holding a message for a full transport */
+int rcvbuf = 0;            /* messages B's application may queue, 0 for unlimited */
+float readrate = 0.0;      /* messages B's application reads per time unit, 0 at once */
+int noverflow = 0;         /* messages delivered into a full receive buffer */
+int drain_stopped = 0;     /* a draining run gave up on a stuck transport */
+
+/* a draining run waits for every message to be delivered, which a stuck */
+/* transport never does.  It stops once the transports have sent this    */
+/* many times the packets a lossless run needs: one, and its ACK, per msg */
+/* (in long, since a big --file or -m times 100 overflows an int)         */
+#define DRAIN_LIMIT 50
 
 /****************************************************************************/
 /* jimsrand(): return a float in range [0,1].  The routine below is used to */
@@ -61,6 +97,10 @@ to, and you defeinitely should not have to modify
 #define  TIMER_INTERRUPT 0
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
+#define  AT_ROUTER       3
+#define  LAYER5_RELEASE  4
+#define  LAYER5_READ     5
+#define  PACE_RELEASE    6
 
 #define  OFF             0
 #define  ON              1
@@ -68,59 +108,208 @@ to, and you defeinitely should not have to modify
 #define   B    1
 
 
+/* Each flow is one independent A/B pair.  Entities in events are numbered */
+/* 2*flow + A and 2*flow + B, so a single flow keeps the original A=0, B=1. */
+#define  ENTITY(f,AorB)  (2*(f) + (AorB))
+#define  FLOW_OF(e)      ((e) / 2)
+#define  SIDE_OF(e)      ((e) % 2)
+
 struct event {
    float evtime;           /* event time */
    int evtype;             /* event type code */
    int eventity;           /* entity where event occurs */
-   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-   struct event *prev;
-   struct event *next;
+   struct pktbuf *buf;     /* packet (if any) assoc w/ this event, one reference */
+   int hop;                /* next hop of a packet crossing a topology */
+   float sendtime;         /* when a packet entered layer 3 */
+   long seq;               /* insertion order, breaks ties in evtime */
+   int cancelled;          /* stopped timer, discarded when it comes up */
+   struct event *next;     /* free list link */
  };
-struct event *evlist = NULL;   /* the event list */
-
-/* msg_track */
-struct msg_track {
-  char msg_chars[20];
-  int delivered;
-}application_msgs[1000];
-int cur_msg_sent = 0, cur_msg_recv = 0;
 
+/* the event list is a binary min-heap ordered by evbefore() */
+struct event **evheap = NULL;
+int evcount = 0, evcap = 0;
+long evseq = 0;
+
+/* events are recycled through a free list instead of being malloc'd */
+/* and freed one at a time                                            */
+#define  EVBLOCK  256
+struct event *evfree = NULL;
+int nevfree = 0;
+
+/* a message on its way from A's layer 5 to B's */
+struct sent_msg {
+  struct msg m;
+  float arrived;           /* time it arrived from layer 5 */
+};
+
+/* a message delivered to B's application, waiting to be read */
+struct rcvd_msg {
+  struct msg m;
+  float arrived;           /* time it arrived from layer 5 at A */
+  float delivered;         /* time the transport passed it to tolayer5() */
+};
+
+/* delay statistics */
+struct delay_stat {
+  long n;
+  double sum;
+  float max;
+};
+struct delay_stat qdelay;     /* layer 5 arrival until A_output() */
+struct delay_stat netdelay;   /* tolayer3() until arrival at B */
+struct delay_stat e2edelay;   /* layer 5 arrival until read at B */
+struct delay_stat rdelay;     /* tolayer5() until B's application reads it */
+int nblocks = 0;              /* times a transport blocked layer 5 */
+
+/* a packet of A's waiting for a token from the pacer */
+struct paced_pkt {
+  struct pktbuf *buf;      /* one reference, the pacer's */
+  float queued;            /* time A sent it */
+};
+
+/* per-flow statistics and delivery tracking */
+struct flow {
+  int A_application;
+  int A_transport;
+  int B_transport;
+  int B_application;
+  int arrivals;            /* layer 5 arrivals scheduled for this flow */
+  std::deque<struct sent_msg> pending;  /* handed to A, not yet delivered at B */
+  int blocked;             /* transport said its send buffer is full */
+  int held;                /* a message is waiting for the transport */
+  struct msg heldmsg;
+  float heldtime;          /* when the held message arrived from layer 5 */
+  std::deque<struct rcvd_msg> rcvq;     /* delivered at B, not yet read */
+  std::deque<struct paced_pkt> paceq;   /* sent by A, not yet let out by the pacer */
+  int pacing;              /* a PACE_RELEASE is scheduled */
+};
+struct flow *flowtab;
+int nflows = 1;
+int cur_flow = 0;              /* flow whose entity is currently running */
+
+struct event **timers;         /* running timer of each entity, or NULL */
+float *last_arrival;           /* latest packet arrival scheduled at each entity */
+
+void flow_report();
+void delay_report();
+void recovery_report();
+void ack_report();
+void read_layer5(int f);
+void schedule_read(int f);
+void give_to_layer4(struct msg message, float arrived, struct upcall *u);
+int simulate(struct protocol_entry *p, int seed);
+void add_delay(struct delay_stat *d, float x);
+void forward_packet(struct event *evptr, int hop);
+void release_paced(int f);
+void count_sent(int AorB, int n);
+
+
+/* true if a must run before b.  Among events due at the same time the most */
+/* recently inserted runs first, as it did with the original sorted list.   */
+int evbefore(struct event *a, struct event *b)
+{
+   if (a->evtime != b->evtime)
+      return a->evtime < b->evtime;
+   return a->seq > b->seq;
+}
 
 void insertevent(struct event *p)
 {
-   struct event *q,*qold;
+   int i, parent;
 
    if (TRACE>2) {
       printf("            INSERTEVENT: time is %lf\n",time_local);
       printf("            INSERTEVENT: future time will be %lf\n",p->evtime);
       }
-   q = evlist;     /* q points to header of list in which p struct inserted */
-   if (q==NULL) {   /* list is empty */
-        evlist=p;
-        p->next=NULL;
-        p->prev=NULL;
-        }
-     else {
-        for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-              qold=q;
-        if (q==NULL) {   /* end of list */
-             qold->next = p;
-             p->prev = qold;
-             p->next = NULL;
-             }
-           else if (q==evlist) { /* front of list */
-             p->next=evlist;
-             p->prev=NULL;
-             p->next->prev=p;
-             evlist = p;
-             }
-           else {     /* middle of list */
-             p->next=q;
-             p->prev=q->prev;
-             q->prev->next=p;
-             q->prev=p;
-             }
+   if (evcount == evcap) {
+      evcap = evcap ? 2*evcap : 64;
+      evheap = (struct event **)realloc(evheap, evcap * sizeof(struct event *));
+      }
+   p->seq = evseq++;
+   p->cancelled = 0;
+
+   /* sift up */
+   for (i = evcount++; i > 0; i = parent) {
+      parent = (i - 1) / 2;
+      if (!evbefore(p, evheap[parent]))
+         break;
+      evheap[i] = evheap[parent];
+      }
+   evheap[i] = p;
+}
+
+/* add n events to the free list in a single allocation */
+void evgrow(int n)
+{
+   struct event *block;
+   int i;
+
+   block = (struct event *)malloc(n * sizeof(struct event));
+   for (i = 0; i < n; i++) {
+      block[i].next = evfree;
+      evfree = &block[i];
+      }
+   nevfree += n;
+}
+
+struct event *newevent()
+{
+   struct event *p;
+
+   if (evfree == NULL)
+      evgrow(EVBLOCK);
+   p = evfree;
+   evfree = p->next;
+   nevfree--;
+   return p;
+}
+
+void freeevent(struct event *p)
+{
+   p->next = evfree;
+   evfree = p;
+   nevfree++;
+}
+
+/* make room for n more events, both on the free list and in the heap, */
+/* so that scheduling them allocates nothing                           */
+void evreserve(int n)
+{
+   if (nevfree < n)
+      evgrow(n - nevfree > EVBLOCK ? n - nevfree : EVBLOCK);
+   if (evcount + n > evcap) {
+      while (evcount + n > evcap)
+         evcap = evcap ? 2*evcap : 64;
+      evheap = (struct event **)realloc(evheap, evcap * sizeof(struct event *));
+      }
+}
+
+/* remove and return the next event to run, discarding stopped timers */
+struct event *nextevent()
+{
+   struct event *top, *last;
+   int i, child;
+
+   while (evcount > 0) {
+      top = evheap[0];
+      last = evheap[--evcount];
+
+      /* sift the last element down from the root */
+      for (i = 0; (child = 2*i + 1) < evcount; i = child) {
+         if (child + 1 < evcount && evbefore(evheap[child+1], evheap[child]))
+            child++;
+         if (!evbefore(evheap[child], last))
+            break;
+         evheap[i] = evheap[child];
          }
+      evheap[i] = last;
+
+      if (!top->cancelled)
+         return top;
+      freeevent(top);
+      }
+   return NULL;
 }
 
 
@@ -131,7 +320,14 @@ void insertevent(struct event *p)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void generate_next_arrival()
+/* true if the run ends once every message has been delivered, rather */
+/* than at the arrival that would exceed -m                           */
+int draining()
+{
+   return traffic_drains() || transfer_active();
+}
+
+void generate_next_arrival(int f)
 {
    double x,log(),ceil();
    struct event *evptr;
@@ -139,19 +335,32 @@ void generate_next_arrival()
    float ttime;
    int tempint;
 
+   /* a source that drains stops once it has produced every message */
+   if (draining() && narrivals == nsimmax)
+       return;
+   /* a file transfer ends after each flow has sent its copy */
+   if (transfer_active() && flowtab[f].arrivals == transfer_messages())
+       return;
+
    if (TRACE>2)
        printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
 
-   x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-                             /* having mean of lambda        */
+   if (traffic_model() == TRAFFIC_LEGACY)
+      x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+                                /* having mean of lambda        */
+   else if ((x = traffic_next_gap(f, time_local)) < 0)
+      return;                   /* this flow's source has run dry */
+   narrivals++;
+   flowtab[f].arrivals++;
+   pending_arrivals++;
 
-   evptr = (struct event *)malloc(sizeof(struct event));
+   evptr = newevent();
    evptr->evtime =  time_local + x;
    evptr->evtype =  FROM_LAYER5;
    if (BIDIRECTIONAL && (jimsrand()>0.5) )
-      evptr->eventity = B;
+      evptr->eventity = ENTITY(f, B);
     else
-      evptr->eventity = A;
+      evptr->eventity = ENTITY(f, A);
    insertevent(evptr);
 }
 
@@ -195,8 +404,17 @@ void init(int seed)                         /* initialize the simulator */
    nlost = 0;
    ncorrupt = 0;
 
+   flowtab = new struct flow[nflows]();
+   timers = (struct event **)calloc(2*nflows, sizeof(struct event *));
+   last_arrival = (float *)calloc(2*nflows, sizeof(float));
+
+   traffic_init(seed, nflows, lambda);
+   transfer_init(nflows);
+   pace_init(nflows);
+
    time_local=0;                    /* initialize time to 0.0 */
-   generate_next_arrival();     /* initialize event list */
+   for (i=0; i<nflows; i++)
+      generate_next_arrival(i);     /* initialize event list */
 }
 
 
@@ -255,22 +473,107 @@ float read_arg_float(char c)
 void display_usage(char *filename)
 {
     printf("Usage:\n %s -s Seed -w Window size -m Number of messages to simulate -l Loss -c Corruption -t Average time between messages from sender's layer5 -v Tracing\n", filename);
+    printf("Optional:\n");
+    printf(" --gilbert p_gb,p_bg[,loss_good[,loss_bad]]  Gilbert-Elliott burst loss (replaces -l)\n");
+    printf(" --ber rate                                  bit error rate per packet bit (replaces -c)\n");
+    printf(" --trace file                                replay loss/delay/corruption for A->B from a trace\n");
+    printf(" --ack-trace file                            same, for the B->A direction\n");
+    printf(" --flows n                                   run n independent A/B pairs (-m counts all flows)\n");
+    printf(" --bottleneck rate[,queue]                   shared A->B link: packets per time unit, queue limit\n");
+    printf(" --topology file                             route packets over a multi-hop topology\n");
+    printf(" --traffic uniform|poisson|onoff:on,off|saturate|trace:file   layer 5 arrival process\n");
+    printf(" --until time                                stop the run at this simulated time\n");
+    printf(" --sndbuf n                                  messages a sender may buffer before blocking layer 5\n");
+    printf(" --rcvbuf n                                  messages B's application may queue unread\n");
+    printf(" --readrate r                                messages per time unit B's application reads\n");
+    printf(" --file path                                 send a file instead of letters, once per flow (replaces -m)\n");
+    printf(" --output path                               write what B's application reads to a file\n");
+    printf(" --checksum sum|inet|crc32c                  packet checksum the protocols use (default sum)\n");
+    printf(" --seqbits k                                 k-bit sequence numbers in packets (default 32)\n");
+    printf(" --dupacks n                                 gbn: go back after n duplicate ACKs, not only on timeout\n");
+    printf(" --ackevery n                                B ACKs every nth in-order packet\n");
+    printf(" --ackdelay t                                B holds an ACK at most t time units\n");
+    printf(" --rto fixed|adaptive[,min[,max]]            retransmission timeout, and report RTTs\n");
+    printf(" --cc none|aimd[,ssthresh]                   congestion control; -w caps the window\n");
+    printf(" --cwnd-log file                             write each flow's congestion window over time\n");
+    printf(" --pace off|rate[,burst]|auto[,burst]        token-bucket pacing of A's packets, and report bursts\n");
+    printf(" --protocol name[,name...]|all               transport to run; several run one after the other\n");
+    printf("Protocols:");
+    list_protocols(stdout);
 }
 
+/* long-only options */
+#define  OPT_GILBERT     256
+#define  OPT_BER         257
+#define  OPT_TRACE       258
+#define  OPT_ACK_TRACE   259
+#define  OPT_FLOWS       260
+#define  OPT_BOTTLENECK  261
+#define  OPT_TOPOLOGY    262
+#define  OPT_TRAFFIC     263
+#define  OPT_UNTIL       264
+#define  OPT_SNDBUF      265
+#define  OPT_RCVBUF      266
+#define  OPT_READRATE    267
+#define  OPT_FILE        268
+#define  OPT_OUTPUT      269
+#define  OPT_CHECKSUM    270
+#define  OPT_PROTOCOL    271
+#define  OPT_SEQBITS     272
+#define  OPT_DUPACKS     273
+#define  OPT_ACKEVERY    274
+#define  OPT_ACKDELAY    275
+#define  OPT_RTO         276
+#define  OPT_CC          277
+#define  OPT_CWND_LOG    278
+#define  OPT_PACE        279
+
+static struct option long_options[] = {
+    {"gilbert", required_argument, 0, OPT_GILBERT},
+    {"ber",     required_argument, 0, OPT_BER},
+    {"trace",   required_argument, 0, OPT_TRACE},
+    {"ack-trace", required_argument, 0, OPT_ACK_TRACE},
+    {"flows",   required_argument, 0, OPT_FLOWS},
+    {"bottleneck", required_argument, 0, OPT_BOTTLENECK},
+    {"topology", required_argument, 0, OPT_TOPOLOGY},
+    {"traffic", required_argument, 0, OPT_TRAFFIC},
+    {"until",   required_argument, 0, OPT_UNTIL},
+    {"sndbuf",  required_argument, 0, OPT_SNDBUF},
+    {"rcvbuf",  required_argument, 0, OPT_RCVBUF},
+    {"readrate", required_argument, 0, OPT_READRATE},
+    {"file",    required_argument, 0, OPT_FILE},
+    {"output",  required_argument, 0, OPT_OUTPUT},
+    {"checksum", required_argument, 0, OPT_CHECKSUM},
+    {"protocol", required_argument, 0, OPT_PROTOCOL},
+    {"seqbits", required_argument, 0, OPT_SEQBITS},
+    {"dupacks", required_argument, 0, OPT_DUPACKS},
+    {"ackevery", required_argument, 0, OPT_ACKEVERY},
+    {"ackdelay", required_argument, 0, OPT_ACKDELAY},
+    {"rto",     required_argument, 0, OPT_RTO},
+    {"cc",      required_argument, 0, OPT_CC},
+    {"cwnd-log", required_argument, 0, OPT_CWND_LOG},
+    {"pace",    required_argument, 0, OPT_PACE},
+    {0, 0, 0, 0}
+};
+
 int main(int argc, char **argv)
 {
-   struct event *eventptr;
-   struct msg  msg2give;
-   struct pkt  pkt2give;
-
-   int i,j;
-   char c;
+   struct protocol_entry *proto;
+   char *protocol_arg = NULL; /* --protocol */
+   char *cwnd_log = NULL;     /* --cwnd-log */
+   int nprotos = 1;
+   int failed = 0;
+   int status;
+   pid_t pid;
 
    int opt;
    int seed;
+   int required = 0;          /* number of mandatory options seen */
+   int single_channel = 0;    /* options that only apply without a topology */
+   char *output = NULL;       /* --output, opened once the flows are known */
 
    //Check for number of arguments
-   if(argc != 15){
+   if(argc < 15){
            fprintf(stderr, "Missing arguments!\n");
         display_usage(argv[0]);
         return -1;
@@ -280,24 +583,165 @@ int main(int argc, char **argv)
     * Parse the arguments
     * http://www.gnu.org/software/libc/manual/html_node/Example-of-Getopt.html
     */
-    while((opt = getopt(argc, argv,"s:w:m:l:c:t:v:")) != -1){
+    while((opt = getopt_long(argc, argv,"s:w:m:l:c:t:v:", long_options, NULL)) != -1){
         switch (opt){
             case 's':   seed = read_arg_int(opt);
+                        required++;
                         break;
             case 'w':   win_size = read_arg_int(opt);
+                        required++;
                         break;
             case 'm':     nsimmax = read_arg_int(opt);
+                        required++;
                         break;
             case 'l':     lossprob = read_arg_float(opt);
+                        required++;
                         break;
             case 'c':     corruptprob = read_arg_float(opt);
+                        required++;
                         break;
             case 't':     if((lambda = atof(optarg)) <= 0.0){
                             fprintf(stderr, "Invalid value for -%c\n", opt);
                             exit(-1);
                         }
+                        required++;
                         break;
             case 'v':     TRACE = read_arg_int(opt);
+                        required++;
+                        break;
+            case OPT_GILBERT:
+                        single_channel++;
+                        if(!channel_set_gilbert(optarg)){
+                            fprintf(stderr, "Invalid value for --gilbert\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_BER:
+                        if(!channel_set_ber(optarg)){
+                            fprintf(stderr, "Invalid value for --ber\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_TRACE:
+                        single_channel++;
+                        if(!channel_set_trace(A, optarg))
+                            exit(-1);
+                        break;
+            case OPT_ACK_TRACE:
+                        single_channel++;
+                        if(!channel_set_trace(B, optarg))
+                            exit(-1);
+                        break;
+            case OPT_FLOWS:
+                        if(!isNumber(optarg) || (nflows = atoi(optarg)) < 1){
+                            fprintf(stderr, "Invalid value for --flows\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_BOTTLENECK:
+                        single_channel++;
+                        if(!channel_set_bottleneck(optarg)){
+                            fprintf(stderr, "Invalid value for --bottleneck\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_TOPOLOGY:
+                        if(!topology_load(optarg))
+                            exit(-1);
+                        break;
+            case OPT_TRAFFIC:
+                        if(!traffic_set(optarg)){
+                            fprintf(stderr, "Invalid value for --traffic\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_SNDBUF:
+                        if(!isNumber(optarg) || (sndbuf = atoi(optarg)) < 1){
+                            fprintf(stderr, "Invalid value for --sndbuf\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_RCVBUF:
+                        if(!isNumber(optarg) || (rcvbuf = atoi(optarg)) < 1){
+                            fprintf(stderr, "Invalid value for --rcvbuf\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_READRATE:
+                        if((readrate = atof(optarg)) <= 0.0){
+                            fprintf(stderr, "Invalid value for --readrate\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_FILE:
+                        if(!transfer_open(optarg))
+                            exit(-1);
+                        break;
+            case OPT_OUTPUT:
+                        output = optarg;
+                        break;
+            case OPT_SEQBITS:
+                        seq_bits = atoi(optarg);
+                        if(!isNumber(optarg) || seq_bits < 1 || seq_bits > 30){
+                            fprintf(stderr, "Invalid value for --seqbits\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_DUPACKS:
+                        dupacks = atoi(optarg);
+                        if(!isNumber(optarg) || dupacks < 1){
+                            fprintf(stderr, "Invalid value for --dupacks\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_ACKEVERY:
+                        ackevery = atoi(optarg);
+                        if(!isNumber(optarg) || ackevery < 1){
+                            fprintf(stderr, "Invalid value for --ackevery\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_ACKDELAY:
+                        if((ackdelay = atof(optarg)) <= 0.0){
+                            fprintf(stderr, "Invalid value for --ackdelay\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_RTO:
+                        if(!rto_set(optarg)){
+                            fprintf(stderr, "Invalid value for --rto\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_CC:
+                        if(!cc_set(optarg)){
+                            fprintf(stderr, "Invalid value for --cc\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_CWND_LOG:
+                        cwnd_log = optarg;
+                        break;
+            case OPT_PACE:
+                        if(!pace_set(optarg)){
+                            fprintf(stderr, "Invalid value for --pace\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_PROTOCOL:
+                        protocol_arg = optarg;
+                        break;
+            case OPT_CHECKSUM:
+                        if(!checksum_set(optarg)){
+                            fprintf(stderr, "Invalid value for --checksum\n");
+                            exit(-1);
+                        }
+                        break;
+            case OPT_UNTIL:
+                        if((until = atof(optarg)) <= 0.0){
+                            fprintf(stderr, "Invalid value for --until\n");
+                            exit(-1);
+                        }
                         break;
             case '?':
                default:    fprintf(stderr, "Invalid arguments!\n");
@@ -306,17 +750,156 @@ int main(int argc, char **argv)
        }
     }
 
+   if(required != 7){
+        fprintf(stderr, "Missing arguments!\n");
+        display_usage(argv[0]);
+        return -1;
+   }
+   if(topology_active() && single_channel){
+        fprintf(stderr, "--topology sets loss and delay per link; it cannot be combined with --gilbert, --trace, --ack-trace or --bottleneck\n");
+        return -1;
+   }
+   if(output != NULL && (!transfer_active() || nflows > 1)){
+        fprintf(stderr, "--output needs --file and a single flow\n");
+        return -1;
+   }
+   if(cwnd_log != NULL && cc_mode() == CC_NONE){
+        fprintf(stderr, "--cwnd-log needs --cc aimd\n");
+        return -1;
+   }
+   if(cwnd_log != NULL && !cc_log(cwnd_log))
+        return -1;
+   if(output != NULL && !transfer_set_output(output))
+        return -1;
+   if(transfer_active()){
+        if(transfer_messages() > 0x7fffffff / nflows){
+            fprintf(stderr, "--file is too large to send over %d flows\n", nflows);
+            return -1;
+        }
+        nsimmax = transfer_messages() * nflows;
+   }
+
+   if(protocol_arg == NULL){
+        /* a binary with one protocol linked in needs no --protocol */
+        if(protocol_list() == NULL || protocol_list()->next != NULL){
+            fprintf(stderr, "Pick a protocol with --protocol:");
+            list_protocols(stderr);
+            return -1;
+        }
+        protocol_list()->selected = 1;
+   }
+   else if((nprotos = select_protocols(protocol_arg)) == 0)
+        return -1;
+   if(nprotos > 1 && output != NULL){
+        fprintf(stderr, "--output needs a single protocol\n");
+        return -1;
+   }
+
+   if(nprotos <= 1){
+        for(proto = protocol_list(); !proto->selected; proto = proto->next)
+            ;
+        return simulate(proto, seed);
+   }
+
+   /* a sweep: each protocol runs in a child of its own, starting from the */
+   /* state the options left, and the runs print one after the other     */
+   for(proto = protocol_list(); proto != NULL; proto = proto->next){
+        if(!proto->selected)
+            continue;
+        fflush(stdout);
+        if((pid = fork()) < 0){
+            perror("fork");
+            return -1;
+        }
+        if(pid == 0){
+            printf("=== protocol %s\n", proto->name);
+            exit(simulate(proto, seed));
+        }
+        if(waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            fprintf(stderr, "protocol %s did not finish\n", proto->name);
+            failed++;
+        }
+   }
+   return failed > 0 ? -1 : 0;
+}
+
+/* one run of the simulation with protocol p */
+int simulate(struct protocol_entry *p, int seed)
+{
+   cc_log_protocol(p->name);
    init(seed);
-   A_init();
-   B_init();
+   p->run();
+
+   //Do NOT change any of the following printfs
+   printf(" Simulator terminated at time %f\n after sending %d msgs from layer5\n",time_local,nsim);
+
+   printf("\n");
+   printf("[PA2]%d packets sent from the Application Layer of Sender A[/PA2]\n", A_application);
+   printf("[PA2]%d packets sent from the Transport Layer of Sender A[/PA2]\n", A_transport);
+   printf("[PA2]%d packets received at the Transport layer of Receiver B[/PA2]\n", B_transport);
+   printf("[PA2]%d packets received at the Application layer of Receiver B[/PA2]\n", B_application);
+   printf("[PA2]Total time: %f time units[/PA2]\n", time_local);
+   printf("[PA2]Throughput: %f packets/time units[/PA2]\n", B_application/time_local);
+   if (drain_stopped)
+      printf("\nRun stopped after %ld packets with %d of %d messages delivered\n",
+             ntolayer3, B_application, nsimmax);
+
+   if (nflows > 1)
+      flow_report();
+   if (sndbuf > 0 || rcvbuf > 0 || readrate > 0.0)
+      delay_report();
+   if (dupacks > 0)
+      recovery_report();
+   if (ackevery > 1 || ackdelay > 0.0)
+      ack_report();
+   rto_report();
+   cc_report();
+   pace_report();
+   transfer_report();
+   traffic_report();
+   channel_report(time_local);
+   topology_report(time_local);
+   return 0;
+}
+
+void sim_enter_flow(int f)
+{
+   cur_flow = f;
+}
+
+/* the event whose upcall the transport is handling */
+struct event *upcall_ev = NULL;
+
+/* a draining source is done once its last message is delivered */
+int drained()
+{
+   return draining() && pending_arrivals == 0 && nheld == 0 &&
+          B_application == A_application;
+}
+
+/* run events until one needs the transport, and describe it in u.  The */
+/* transport handles it before calling sim_next() again.  Returns 0 once */
+/* the run is over.                                                      */
+int sim_next(struct upcall *u)
+{
+   struct event *eventptr;
+   struct msg  msg2give;
+   int i,j;
+
+   if (upcall_ev != NULL) {           /* the transport is done with it */
+        if (upcall_ev->evtype == FROM_LAYER3)
+           pktbuf_unref(upcall_ev->buf);     /* drop the channel's reference */
+        freeevent(upcall_ev);
+        upcall_ev = NULL;
+        if (drained())
+           return 0;
+        }
 
    while (1) {
-        eventptr = evlist;            /* get next event to simulate */
+        eventptr = nextevent();       /* get next event to simulate */
         if (eventptr==NULL)
-           goto terminate;
-        evlist = evlist->next;        /* remove this event from event list */
-        if (evlist!=NULL)
-           evlist->prev=NULL;
+           return 0;
+        cur_flow = FLOW_OF(eventptr->eventity);
         if (TRACE>=2) {
            printf("\nEVENT time: %f,",eventptr->evtime);
            printf("  type: %d",eventptr->evtype);
@@ -324,19 +907,41 @@ int main(int argc, char **argv)
            printf(", timerinterrupt  ");
              else if (eventptr->evtype==1)
                printf(", fromlayer5 ");
+             else if (eventptr->evtype==AT_ROUTER)
+               printf(", atrouter ");
+             else if (eventptr->evtype==LAYER5_RELEASE)
+               printf(", layer5release ");
+             else if (eventptr->evtype==LAYER5_READ)
+               printf(", layer5read ");
+             else if (eventptr->evtype==PACE_RELEASE)
+               printf(", pacerelease ");
              else
          printf(", fromlayer3 ");
            printf(" entity: %d\n",eventptr->eventity);
            }
+        if (until > 0.0 && eventptr->evtime > until) {
+            time_local = until;
+            return 0;               /* out of time */
+            }
         time_local = eventptr->evtime;        /* update time to next event time */
-        if (nsim==nsimmax)
-      break;                        /* all done with simulation */
+        if (nsim==nsimmax && !draining())
+      return 0;                     /* all done with simulation */
+        if (draining() && ntolayer3 > DRAIN_LIMIT * 2L * nsimmax) {
+            drain_stopped = 1;
+            return 0;               /* the transport is not getting there */
+            }
         if (eventptr->evtype == FROM_LAYER5 ) {
-            generate_next_arrival();   /* set up future arrival */
-            /* fill in msg to give with string of same letter */
-            j = nsim % 26;
-            for (i=0; i<20; i++)
-               msg2give.data[i] = 97 + j;
+            pending_arrivals--;
+            if (!flowtab[cur_flow].blocked)
+               generate_next_arrival(cur_flow);   /* set up future arrival */
+            if (transfer_active())
+               transfer_next_msg(cur_flow, time_local, &msg2give);
+            else {
+               /* fill in msg to give with string of same letter */
+               j = nsim % 26;
+               for (i=0; i<20; i++)
+                  msg2give.data[i] = 97 + j;
+               }
             if (TRACE>2) {
                printf("          MAINLOOP: data given to student: ");
                  for (i=0; i<20; i++)
@@ -344,15 +949,21 @@ int main(int argc, char **argv)
                printf("\n");
          }
             nsim++;
-            if (eventptr->eventity == A)
+            if (SIDE_OF(eventptr->eventity) == A)
             {
-                A_application += 1;
-
-              memcpy(application_msgs[cur_msg_sent].msg_chars, msg2give.data, 20);
-              application_msgs[cur_msg_sent].delivered = 0;
-              cur_msg_sent += 1;
-
-              A_output(msg2give);
+              if (flowtab[cur_flow].blocked) {
+                 /* the transport is full: the application blocks on this */
+                 /* message, and its source stops until it is taken       */
+                 flowtab[cur_flow].held = 1;
+                 flowtab[cur_flow].heldmsg = msg2give;
+                 flowtab[cur_flow].heldtime = time_local;
+                 nheld++;
+              }
+              else {
+                 give_to_layer4(msg2give, time_local, u);
+                 upcall_ev = eventptr;
+                 return 1;
+              }
             }
             /*
              else
@@ -360,46 +971,63 @@ int main(int argc, char **argv)
                */
             }
           else if (eventptr->evtype ==  FROM_LAYER3) {
-            pkt2give.seqnum = eventptr->pktptr->seqnum;
-            pkt2give.acknum = eventptr->pktptr->acknum;
-            pkt2give.checksum = eventptr->pktptr->checksum;
-            for (i=0; i<20; i++)
-                pkt2give.payload[i] = eventptr->pktptr->payload[i];
-        if (eventptr->eventity ==A)      /* deliver packet by calling */
-              A_input(pkt2give);            /* appropriate entity */
+        if (SIDE_OF(eventptr->eventity) ==A) {    /* deliver packet by calling */
+              pace_ack(cur_flow, time_local);
+              u->type = UP_A_INPUT;         /* appropriate entity */
+            }
             else
             {
+                add_delay(&netdelay, time_local - eventptr->sendtime);
                 B_transport += 1;
-                B_input(pkt2give);
+                flowtab[cur_flow].B_transport += 1;
+                u->type = UP_B_INPUT;
+            }
+            u->pkt = &eventptr->buf->pkt;
+            upcall_ev = eventptr;
+            return 1;
+            }
+          else if (eventptr->evtype ==  LAYER5_RELEASE) {
+            struct flow *fl = &flowtab[cur_flow];
+            if (fl->held && !fl->blocked) {
+               fl->held = 0;
+               nheld--;
+               generate_next_arrival(cur_flow);   /* restart the source */
+               give_to_layer4(fl->heldmsg, fl->heldtime, u);
+               upcall_ev = eventptr;
+               return 1;
+               }
+            }
+          else if (eventptr->evtype ==  LAYER5_READ) {
+            read_layer5(cur_flow);
+            if (!flowtab[cur_flow].rcvq.empty())
+               schedule_read(cur_flow);       /* keep reading at the same pace */
+            }
+          else if (eventptr->evtype ==  PACE_RELEASE) {
+            release_paced(cur_flow);
             }
-        free(eventptr->pktptr);          /* free the memory for packet */
+          else if (eventptr->evtype ==  AT_ROUTER) {
+            forward_packet(eventptr, eventptr->hop);
+            continue;                       /* the event moves on to the next hop */
             }
           else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-            if (eventptr->eventity == A)
-           A_timerinterrupt();
-               /*
-             else
-           B_timerinterrupt();
-               */
+            timers[eventptr->eventity] = NULL;
+            if (SIDE_OF(eventptr->eventity) == A)
+               u->type = UP_A_TIMER;
+            else {
+               nacktimer++;
+               u->type = UP_B_TIMER;
+               }
+            upcall_ev = eventptr;
+            return 1;
              }
           else  {
          printf("INTERNAL PANIC: unknown event type \n");
              }
-        free(eventptr);
-        }
+        freeevent(eventptr);
 
-terminate:
-   //Do NOT change any of the following printfs
-   printf(" Simulator terminated at time %f\n after sending %d msgs from layer5\n",time_local,nsim);
-
-   printf("\n");
-   printf("[PA2]%d packets sent from the Application Layer of Sender A[/PA2]\n", A_application);
-   printf("[PA2]%d packets sent from the Transport Layer of Sender A[/PA2]\n", A_transport);
-   printf("[PA2]%d packets received at the Transport layer of Receiver B[/PA2]\n", B_transport);
-   printf("[PA2]%d packets received at the Application layer of Receiver B[/PA2]\n", B_application);
-   printf("[PA2]Total time: %f time units[/PA2]\n", time_local);
-   printf("[PA2]Throughput: %f packets/time units[/PA2]\n", B_application/time_local);
-   return 0;
+        if (drained())
+           return 0;
+        }
 }
 
 
@@ -437,13 +1065,135 @@ void printevlist()
 {
   struct event *q;
   int i;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  printf("--------------\nEvent List Follows (heap order):\n");
+  for(i = 0; i < evcount; i++) {
+    q = evheap[i];
+    if (!q->cancelled)
+      printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
     }
   printf("--------------\n");
 }
 
+void add_delay(struct delay_stat *d, float x)
+{
+  d->n++;
+  d->sum += x;
+  if (x > d->max)
+    d->max = x;
+}
+
+/* hand a message that arrived from layer 5 at time arrived to A */
+void give_to_layer4(struct msg message, float arrived, struct upcall *u)
+{
+  struct sent_msg sm;
+
+  A_application += 1;
+  flowtab[cur_flow].A_application += 1;
+  add_delay(&qdelay, time_local - arrived);
+
+  sm.m = message;
+  sm.arrived = arrived;
+  flowtab[cur_flow].pending.push_back(sm);
+
+  u->type = UP_A_OUTPUT;
+  u->msg = message;
+}
+
+void delay_report()
+{
+  printf("\nDelay statistics:\n");
+  printf(" layer 5 blocked %d time(s)\n", nblocks);
+  printf(" queueing delay (layer 5 to A_output): mean %f, max %f\n",
+         qdelay.n ? qdelay.sum / qdelay.n : 0.0, qdelay.max);
+  printf(" network delay (tolayer3 to B, per packet): mean %f, max %f\n",
+         netdelay.n ? netdelay.sum / netdelay.n : 0.0, netdelay.max);
+  printf(" end-to-end delay (layer 5 to layer 5): mean %f, max %f\n",
+         e2edelay.n ? e2edelay.sum / e2edelay.n : 0.0, e2edelay.max);
+  if (rcvbuf > 0 || readrate > 0.0) {
+     printf(" receive buffer delay (tolayer5 to application read): mean %f, max %f\n",
+            rdelay.n ? rdelay.sum / rdelay.n : 0.0, rdelay.max);
+     printf(" receive buffer overflowed %d time(s)\n", noverflow);
+     }
+}
+
+void recovery_report()
+{
+  int n = nrecover[RECOVERY_TIMEOUT] + nrecover[RECOVERY_FAST];
+
+  printf("\nRecovery statistics:\n");
+  printf(" %d recoveries: %d fast (after %d duplicate ACKs), %d after a timeout\n",
+         n, nrecover[RECOVERY_FAST], dupacks, nrecover[RECOVERY_TIMEOUT]);
+  if (n > 0)
+     printf(" fast share: %.1f%%\n", 100.0 * nrecover[RECOVERY_FAST] / n);
+  if (nrecover[RECOVERY_REPAIR] > 0)
+     printf(" %d repair batch(es) sent on the receiver's feedback\n", nrecover[RECOVERY_REPAIR]);
+}
+
+/* what holding back ACKs saved on the reverse path, and what it cost */
+void ack_report()
+{
+  printf("\nACK statistics:\n");
+  if (ackevery > 0 && ackdelay > 0.0)
+     printf(" policy: ACK every %d in-order packets, or %f time units after the first\n",
+            ackevery, ackdelay);
+  else if (ackevery > 0)
+     printf(" policy: ACK every %d in-order packets\n", ackevery);
+  else
+     printf(" policy: ACK in-order packets %f time units after the first\n", ackdelay);
+  printf(" %d data packets reached B, %d ACKs sent: %f ACKs per data packet\n",
+         B_transport, B_acks, B_transport ? (double)B_acks / B_transport : 0.0);
+  printf(" %d ACKs sent when B's timer went off\n", nacktimer);
+  printf(" throughput %f packets/time units, end-to-end delay mean %f, max %f\n",
+         B_application / time_local, e2edelay.n ? e2edelay.sum / e2edelay.n : 0.0,
+         e2edelay.max);
+}
+
+/* B's application of flow f reads the oldest message waiting for it */
+void read_layer5(int f)
+{
+  struct rcvd_msg rm = flowtab[f].rcvq.front();
+
+  flowtab[f].rcvq.pop_front();
+  add_delay(&rdelay, time_local - rm.delivered);
+  add_delay(&e2edelay, time_local - rm.arrived);
+  if (transfer_active())
+    transfer_deliver(f, time_local, rm.m.data);
+  B_application += 1;
+  flowtab[f].B_application += 1;
+}
+
+/* the next read of flow f happens one read time from now */
+void schedule_read(int f)
+{
+  struct event *evptr;
+
+  evptr = newevent();
+  evptr->evtime = time_local + 1.0/readrate;
+  evptr->evtype = LAYER5_READ;
+  evptr->eventity = ENTITY(f, B);
+  insertevent(evptr);
+}
+
+/* per-flow throughput, Jain's fairness index over those throughputs and */
+/* the aggregate, for runs with more than one flow                        */
+void flow_report()
+{
+  int f;
+  double x, sum = 0.0, sumsq = 0.0;
+
+  printf("\nFlow statistics:\n");
+  for (f = 0; f < nflows; f++) {
+    x = flowtab[f].B_application / time_local;
+    sum += x;
+    sumsq += x*x;
+    printf(" flow %d: app A %d, transport A %d, transport B %d, app B %d, throughput %f\n",
+           f, flowtab[f].A_application, flowtab[f].A_transport,
+           flowtab[f].B_transport, flowtab[f].B_application, x);
+  }
+  printf(" aggregate throughput: %f packets/time units\n", sum);
+  printf(" jain fairness index: %f\n", sumsq > 0.0 ? sum*sum / (nflows*sumsq) : 0.0);
+}
+
 
 
 /********************** Student-callable ROUTINES ***********************/
@@ -452,29 +1202,16 @@ void printevlist()
 void stoptimer(int AorB)
  //AorB;  /* A or B is trying to stop timer */
 {
- struct event *q,*qold;
+ int ent = ENTITY(cur_flow, AorB);
 
  if (TRACE>2)
     printf("          STOP TIMER: stopping timer at %f\n",time_local);
-/* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
- for (q=evlist; q!=NULL ; q = q->next)
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) {
-       /* remove this event */
-       if (q->next==NULL && q->prev==NULL)
-             evlist=NULL;         /* remove first and only event on list */
-          else if (q->next==NULL) /* end of list - there is one in front */
-             q->prev->next = NULL;
-          else if (q==evlist) { /* front of list - there must be event after */
-             q->next->prev=NULL;
-             evlist = q->next;
-             }
-           else {     /* middle of list */
-             q->next->prev = q->prev;
-             q->prev->next =  q->next;
-             }
-       free(q);
-       return;
-     }
+ if (timers[ent] != NULL) {
+    /* the event stays in the heap and is discarded when it comes up */
+    timers[ent]->cancelled = 1;
+    timers[ent] = NULL;
+    return;
+  }
   printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
@@ -484,94 +1221,125 @@ void starttimer(int AorB,float increment)
 
 {
 
- struct event *q;
  struct event *evptr;
+ int ent = ENTITY(cur_flow, AorB);
  ////char *malloc();
 
  if (TRACE>2)
     printf("          START TIMER: starting timer at %f\n",time_local);
  /* be nice: check to see if timer is already started, if so, then  warn */
-/* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-   for (q=evlist; q!=NULL ; q = q->next)
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) {
+   if (timers[ent] != NULL) {
       printf("Warning: attempt to start a timer that is already started\n");
       return;
       }
 
 /* create future event for when timer goes off */
-   evptr = (struct event *)malloc(sizeof(struct event));
+   evptr = newevent();
    evptr->evtime =  time_local + increment;
    evptr->evtype =  TIMER_INTERRUPT;
-   evptr->eventity = AorB;
+   evptr->eventity = ent;
    insertevent(evptr);
+   timers[ent] = evptr;
 }
 
 
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB,struct pkt packet)
+/* carry a packet across the next hop of its path through the topology. */
+/* The event is rescheduled for its arrival at the next router, or at    */
+/* the destination entity after the last hop.                            */
+void forward_packet(struct event *evptr, int hop)
 {
- struct pkt *mypktptr;
- struct event *evptr,*q;
- ////char *malloc();
- float lastime, x, jimsrand();
- int i;
+   float arrive;
+   int last;
 
+   if (!topology_hop((SIDE_OF(evptr->eventity)+1) % 2, hop, time_local, &arrive, &last)) {
+      nlost++;
+      pktbuf_unref(evptr->buf);
+      freeevent(evptr);
+      return;
+      }
+   evptr->evtime = arrive;
+   evptr->evtype = last ? FROM_LAYER3 : AT_ROUTER;
+   evptr->hop = hop + 1;
+   insertevent(evptr);
+}
 
- ntolayer3++;
-
- if(AorB == 0) A_transport += 1;
+/************************** TOLAYER3 ***************/
+/* put one packet on the wire; the caller has already counted it.  A  */
+/* packet that survives is carried under the channel's own reference  */
+/* to b, so b may be the sender's retained copy.                      */
+void send_packet(int AorB, struct pktbuf *b)
+{
+ struct pktbuf *mybuf;
+ struct event *evptr;
+ ////char *malloc();
+ float lastime, depart, jimsrand();
+ int i, dest;
+
+ /* with a topology, loss and delay happen link by link along the path */
+ if (topology_active()) {
+    mybuf = pktbuf_ref(b);
+    if (channel_corrupt(AorB, &mybuf))  {
+       ncorrupt++;
+       if (TRACE>0)
+       printf("          TOLAYER3: packet being corrupted\n");
+       }
+    evptr = newevent();
+    evptr->eventity = ENTITY(cur_flow, (AorB+1) % 2);
+    evptr->buf = mybuf;
+    evptr->sendtime = time_local;
+    forward_packet(evptr, 0);
+    return;
+ }
+
+ /* queue at the shared bottleneck, if there is one */
+ if (!channel_admit(AorB, time_local, &depart))  {
+      nlost++;
+      if (AorB == A)
+         pace_dropped(cur_flow);
+      if (TRACE>0)
+    printf("          TOLAYER3: packet dropped at bottleneck\n");
+      return;
+    }
 
  /* simulate losses: */
- if (jimsrand() < lossprob)  {
+ if (channel_lose(AorB))  {
       nlost++;
       if (TRACE>0)
     printf("          TOLAYER3: packet being lost\n");
       return;
     }
 
-/* make a copy of the packet student just gave me since he/she may decide */
-/* to do something with the packet after we return back to him/her */
- mypktptr = (struct pkt *)malloc(sizeof(struct pkt));
- mypktptr->seqnum = packet.seqnum;
- mypktptr->acknum = packet.acknum;
- mypktptr->checksum = packet.checksum;
- for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
+/* share the student's buffer rather than copying it; it is only copied */
+/* below if the channel corrupts it, so his/her copy stays intact        */
+ mybuf = pktbuf_ref(b);
  if (TRACE>2)  {
-   printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-      mypktptr->acknum,  mypktptr->checksum);
+   printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mybuf->pkt.seqnum,
+      mybuf->pkt.acknum,  mybuf->pkt.checksum);
     for (i=0; i<20; i++)
-        printf("%c",mypktptr->payload[i]);
+        printf("%c",mybuf->pkt.payload[i]);
     printf("\n");
    }
 
 /* create future event for arrival of packet at the other side */
-  evptr = (struct event *)malloc(sizeof(struct event));
+  evptr = newevent();
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
-  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  dest = ENTITY(cur_flow, (AorB+1) % 2);
+  evptr->eventity = dest;         /* event occurs at other entity */
+  evptr->buf = mybuf;             /* save ptr to my reference to the packet */
+  evptr->sendtime = time_local;
 /* finally, compute the arrival time of packet at the other end.
    medium can not reorder, so make sure packet arrives between 1 and 10
    time units after the latest arrival time of packets
    currently in the medium on their way to the destination */
- lastime = time_local;
-/* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
- for (q=evlist; q!=NULL ; q = q->next)
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) )
-      lastime = q->evtime;
- evptr->evtime =  lastime + 1 + 9*jimsrand();
+ lastime = last_arrival[dest] > depart ? last_arrival[dest] : depart;
+ evptr->evtime =  channel_arrival(AorB, depart, lastime);
+ last_arrival[dest] = evptr->evtime;
 
 
 
  /* simulate corruption: */
- if (jimsrand() < corruptprob)  {
+ if (channel_corrupt(AorB, &evptr->buf))  {
     ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-       mypktptr->payload[0]='Z';   /* corrupt payload */
-      else if (x < .875)
-       mypktptr->seqnum = 999999;
-      else
-       mypktptr->acknum = 999999;
     if (TRACE>0)
     printf("          TOLAYER3: packet being corrupted\n");
     }
@@ -581,42 +1349,229 @@ void tolayer3(int AorB,struct pkt packet)
   insertevent(evptr);
 }
 
-void tolayer5(int AorB,char *datasent)
+/* let flow f's pacer queue out as far as its tokens go, and come back */
+/* when the next one is due                                            */
+void schedule_pace(int f)
 {
-  int i;
-  if (TRACE>2) {
-     printf("          TOLAYER5: data received: ");
-     for (i=0; i<20; i++)
-        printf("%c",datasent[i]);
-     printf("\n");
-   }
+ struct event *evptr;
+
+ evptr = newevent();
+ evptr->evtime = pace_due(f, time_local);
+ evptr->evtype = PACE_RELEASE;
+ evptr->eventity = ENTITY(f, A);
+ evptr->buf = NULL;
+ insertevent(evptr);
+ flowtab[f].pacing = 1;
+}
+
+void release_paced(int f)
+{
+ struct flow *fl = &flowtab[f];
+ struct paced_pkt p;
+ int due = 1;                  /* this event was scheduled for a token */
+
+ fl->pacing = 0;
+ while (!fl->paceq.empty() && pace_take(f, time_local, due)) {
+    p = fl->paceq.front();
+    fl->paceq.pop_front();
+    pace_sent(f, time_local, time_local - p.queued);
+    send_packet(A, p.buf);
+    pktbuf_unref(p.buf);
+    due = 0;
+    }
+ if (!fl->paceq.empty())
+    schedule_pace(f);
+}
+
+/* hand a packet to the channel, unless it is A's and has to wait for */
+/* the pacer (see --pace); it then keeps its own reference to b.  A   */
+/* retransmission of a buffer that is still waiting is dropped, as    */
+/* Linux does for a packet still in a host queue: the copy waiting    */
+/* will go out anyway, so it is taken back out of the counts.         */
+void pace_packet(int AorB, struct pktbuf *b)
+{
+ struct flow *fl = &flowtab[cur_flow];
+ struct paced_pkt p;
+ size_t i;
+
+ if (AorB == B) {
+    send_packet(AorB, b);
+    return;
+    }
+ if (fl->paceq.empty() && pace_take(cur_flow, time_local, 0)) {
+    pace_sent(cur_flow, time_local, 0.0);
+    send_packet(AorB, b);
+    return;
+    }
+ for (i = 0; i < fl->paceq.size(); i++)
+    if (fl->paceq[i].buf == b) {
+       pace_absorbed(cur_flow);
+       count_sent(AorB, -1);
+       return;
+       }
+ p.buf = pktbuf_ref(b);
+ p.queued = time_local;
+ fl->paceq.push_back(p);
+ pace_queued(cur_flow, fl->paceq.size());
+ if (!fl->pacing)
+    schedule_pace(cur_flow);
+}
+
+/* count n packets handed to layer 3 by the running entity */
+void count_sent(int AorB, int n)
+{
+ ntolayer3 += n;
+
+ if(AorB == 0) {
+    A_transport += n;
+    flowtab[cur_flow].A_transport += n;
+ }
+ else
+    B_acks += n;
+}
+
+void tolayer3(int AorB,struct pkt packet)
+{
+ struct pktbuf *b;
+
+/* make a copy of the packet student just gave me since he/she may decide */
+/* to do something with the packet after we return back to him/her */
+ count_sent(AorB, 1);
+ b = pktbuf_alloc();
+ b->pkt = packet;
+ pace_packet(AorB, b);
+ pktbuf_unref(b);
+}
 
+/* send a packet the student keeps in a buffer, without copying it */
+void tolayer3_buf(int AorB, struct pktbuf *b)
+{
+ count_sent(AorB, 1);
+ pace_packet(AorB, b);
+}
+
+/* send n packets back to back.  Each one meets the channel exactly as */
+/* it would in its own tolayer3() call, in the same order, so losses,  */
+/* corruption and arrival times are unchanged; the counting and the    */
+/* room for the arrival events are taken care of once for the batch.  */
+void tolayer3_batch(int AorB, const struct pkt *packets, int n)
+{
+ struct pktbuf *b;
+ int i;
+
+ if (n <= 0)
+    return;
+ count_sent(AorB, n);
+ evreserve(n);
+ for (i=0; i<n; i++) {
+    b = pktbuf_alloc();
+    b->pkt = packets[i];
+    pace_packet(AorB, b);
+    pktbuf_unref(b);
+    }
+}
+
+/* tolayer3_batch() for packets the student keeps in buffers */
+void tolayer3_buf_batch(int AorB, struct pktbuf *const *bufs, int n)
+{
+ int i;
+
+ if (n <= 0)
+    return;
+ count_sent(AorB, n);
+ evreserve(n);
+ for (i=0; i<n; i++)
+    pace_packet(AorB, bufs[i]);
+}
+
+/* make sure data is the i-th message still on its way to B, i.e. that */
+/* nothing was lost, duplicated or reordered ahead of it                */
+void check_delivery(std::deque<struct sent_msg> &pending, unsigned int i, const char *data)
+{
    /* Check for non-existent packet */
-   if (application_msgs[cur_msg_recv].msg_chars[0] == '\0') {
+   if (i >= pending.size()) {
        printf("PANIC: Unexpected/Non-existent packet!");
        exit(52);
    }
 
   /* Check for out-of-order/duplicate packets */
-  if (strncmp(application_msgs[cur_msg_recv].msg_chars, datasent, 20) != 0){
+  if (memcmp(pending[i].m.data, data, 20) != 0){
     printf("Expected: ");
-    for(int i=0; i<20; i+=1)
-      printf("%c", application_msgs[cur_msg_recv].msg_chars[i]);
+    for(int j=0; j<20; j+=1)
+      printf("%c", pending[i].m.data[j]);
     printf("\nGot: ");
-    for(int i=0; i<20; i+=1)
-      printf("%c", datasent[i]);
+    for(int j=0; j<20; j+=1)
+      printf("%c", data[j]);
     exit(63);
   }
+}
 
-  if (cur_msg_recv != 0){
-    if (application_msgs[cur_msg_recv-1].delivered != 1)
-      exit(145);
+/* the checked message at the front of pending reaches B's application */
+void accept_delivery(int AorB, std::deque<struct sent_msg> &pending)
+{
+  struct rcvd_msg rm;
+
+  rm.arrived = pending.front().arrived;
+  rm.delivered = time_local;
+  if (transfer_active())
+    rm.m = pending.front().m;      /* the application will want the bytes */
+  pending.pop_front(); // Mark delivered
+
+  if(AorB == 1) {
+     std::deque<struct rcvd_msg> &rcvq = flowtab[cur_flow].rcvq;
+
+     if (rcvbuf > 0 && (int)rcvq.size() >= rcvbuf) {
+        /* the transport ignored the advertised window: the message is lost */
+        noverflow++;
+        if (TRACE>0)
+           printf("          TOLAYER5: receive buffer full, message dropped\n");
+        return;
+        }
+     rcvq.push_back(rm);
+     if (readrate <= 0.0)
+        read_layer5(cur_flow);      /* the application reads at once */
+     else if (rcvq.size() == 1)
+        schedule_read(cur_flow);    /* the reader was idle */
   }
+}
+
+void tolayer5(int AorB,char *datasent)
+{
+  int i;
+  if (TRACE>2) {
+     printf("          TOLAYER5: data received: ");
+     for (i=0; i<20; i++)
+        printf("%c",datasent[i]);
+     printf("\n");
+   }
 
-  application_msgs[cur_msg_recv].delivered = 1; // Mark delivered
-  cur_msg_recv += 1;
+   std::deque<struct sent_msg> &pending = flowtab[cur_flow].pending;
 
-  if(AorB == 1) B_application += 1;
+   check_delivery(pending, 0, datasent);
+   accept_delivery(AorB, pending);
+}
+
+/* deliver n messages in order, read in place from the transport's own  */
+/* buffer: message i starts at data + i*stride.  The whole run is        */
+/* checked before any of it is handed over.                              */
+void tolayer5_batch(int AorB, const char *data, int n, int stride)
+{
+  int i, k;
+  if (TRACE>2) {
+     for (k=0; k<n; k++) {
+        printf("          TOLAYER5: data received: ");
+        for (i=0; i<20; i++)
+           printf("%c",data[k*stride + i]);
+        printf("\n");
+        }
+   }
+
+   std::deque<struct sent_msg> &pending = flowtab[cur_flow].pending;
+
+   for (k=0; k<n; k++)
+      check_delivery(pending, k, data + k*stride);
+   for (k=0; k<n; k++)
+      accept_delivery(AorB, pending);
 }
 
 int getwinsize()
@@ -624,7 +1579,94 @@ int getwinsize()
     return win_size;
 }
 
+int getseqbits()
+{
+    return seq_bits;
+}
+
+int getdupacks()
+{
+    return dupacks;
+}
+
+int getackevery()
+{
+    return ackevery;
+}
+
+float getackdelay()
+{
+    return ackdelay;
+}
+
+void count_recovery(int AorB, int how)
+{
+    nrecover[how]++;
+}
+
 float get_sim_time()
 {
     return time_local;
 }
+
+int getsndbuf()
+{
+    return sndbuf;
+}
+
+/* called by a transport whose send buffer is full.  Layer 5 arrivals for */
+/* this flow are held, one at a time, until it calls unblocklayer5().     */
+void blocklayer5(int AorB)
+{
+    if (TRACE>2)
+       printf("          BLOCKLAYER5: send buffer full at %f\n",time_local);
+    if (!flowtab[cur_flow].blocked)
+       nblocks++;
+    flowtab[cur_flow].blocked = 1;
+}
+
+/* the held message is handed over from a separate event, so A_output() */
+/* is never re-entered from inside the transport's own routines         */
+void unblocklayer5(int AorB)
+{
+    struct event *evptr;
+
+    if (!flowtab[cur_flow].blocked)
+       return;
+    flowtab[cur_flow].blocked = 0;
+    if (!flowtab[cur_flow].held)
+       return;
+    evptr = newevent();
+    evptr->evtime = time_local;
+    evptr->evtype = LAYER5_RELEASE;
+    evptr->eventity = ENTITY(cur_flow, A);
+    insertevent(evptr);
+}
+
+/* for transports that count what waits beyond their window: layer 5 */
+/* waits once that fills --sndbuf and resumes when there is room       */
+void setbacklog(int AorB, int n)
+{
+    if (sndbuf > 0 && n >= sndbuf)
+       blocklayer5(AorB);
+    else
+       unblocklayer5(AorB);
+}
+
+/* messages B's application can still take before its buffer is full */
+int getrcvwnd(int AorB)
+{
+    if (rcvbuf == 0)
+       return RCVWND_UNLIMITED;
+    return rcvbuf - (int)flowtab[cur_flow].rcvq.size();
+}
+
+int get_flow()
+{
+    return cur_flow;
+}
+
+int get_nflows()
+{
+    return nflows;
+}
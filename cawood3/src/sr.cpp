@@ -1,7 +1,15 @@
-#include "../include/simulator.h"
+#include "../include/protocol.h"
+#include "../include/checksum.h"
+#include "../include/window.h"
+#include "../include/ackpolicy.h"
+#include "../include/rto.h"
+#include "../include/cwnd.h"
 #include <iostream>
 #include <cstring>
 #include <vector>
+#include <algorithm>
+
+namespace {
 
 /* ******************************************************************
  ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
@@ -20,153 +28,261 @@
 #define A 0
 #define B 1
 
-// Struct defining packet metadata
+// Struct defining packet metadata, one per slot of A's window
 struct pktData {
-  pkt packet;
+  pktbuf *buf; // Shared with the channel while in flight, released once ackd
 
   int timeSent;
+  unsigned sends; // Times this slot has gone out, tells a current sendRec from a stale one
+  float firstSent; // When this packet first went out, for an RTT sample
+  bool resent;     // Went out more than once, so its ACK is no sample (Karn)
+};
+
+// One send waiting out its TIMEOUT. These are queued in the order they went out
+struct sendRec {
+  seq_t seq;
+  int timeSent;
+  unsigned sends;
+};
 
-  bool wasSent;
-  bool wasAckd;
+// A payload B holds until everything before it has arrived
+struct rcvSlot {
+  char payload[20];
 };
 
 float TIMEOUT = 50;
-int ASeqnumFirst = 0;            // SeqNum of first frame in window. Same as send_base
-int ASeqnumN = 0;                // SeqNum of Nth frame in window. Same as nextseqnum
-std::vector<pktData> packets;    // To store all frames of data. This acts as our sender view
-int it = -1;                     // Ensures physical timer is only called once in A_output
 
-int BRcvBase = 0;                // Expected SeqNum of first frame in receiver window. Same as rcv_base
-int BRcvN = 0;
-std::vector<pktData> recvBuffer; // Buffer of received packets. Will help deliver consecutively numbered packets
+// Per-flow state, one entry per A/B pair (see get_flow())
+struct srFlow {
+  // Sent and not yet ackd, from base() (send_base) up to next() (nextseqnum); a ring
+  // of -w slots whose ack bitmap lets the base jump over every ackd packet at once
+  sliding_window<pktData, dynamic_ring<pktData>, selective_ack> window;
+  ring_queue<msg> messageBuffer;   // Messages waiting for room in the window
+  ring_queue<sendRec> sendLog;     // Sends not yet known to be ackd or expired, oldest first
+  std::vector<pktbuf*> batch;      // Packets going out together
+  std::vector<seq_t> expired;      // Packets to retransmit
+  int it = -1;                     // Ensures physical timer is only called once in A_output
+  int rwnd = -1;                   // Window B last advertised, -1 until the first ACK
+  rto_estimator rto;               // Our timeout, TIMEOUT unless --rto adaptive
+  congestion cc;                   // Window the channel can take, -w unless --cc aimd
 
-// HELPER FUNCTIONS
-int getChecksum(struct pkt packet)
-{
-	int checksum = packet.seqnum + packet.acknum;
-	for (int i=0; i<20; i++) {
-		checksum += packet.payload[i];
-	}
-	return checksum;
+  // Payloads received ahead of rcv_base (recvWindow.base()), in a ring of -w slots with a bitmap
+  // of which are here. Consecutively numbered ones go up straight out of their slots
+  receive_window<rcvSlot> recvWindow;
+  delayed_ack delack;              // In-order packets B hasn't ACKd yet, see --ackevery
+};
+std::vector<srFlow> flows;
+
+srFlow &thisFlow() {
+  // sized on first use, once the simulator knows how many flows it runs
+  if(flows.empty()) flows.resize(get_nflows());
+  return flows[get_flow()];
 }
 
+// HELPER FUNCTIONS
 pkt makePkt(char payload[], int seqnum, int acknum) {
   pkt res;
-  strncpy(res.payload, payload, 20);
+  memcpy(res.payload, payload, 20);
   res.seqnum = seqnum;
   res.acknum = acknum;
-  res.checksum = getChecksum(res);
+  res.rcvwnd = getrcvwnd(B);     // Only meaningful in B's ACKs
+  res.checksum = pkt_checksum(&res);
   return res;
 }
 
-pktData makePktData(char payload[], int seqnum, int acknum) {
-  pktData res;
-  res.packet = makePkt(payload, seqnum, acknum);
-  res.timeSent = get_sim_time();
-  return res;
+// An ackd packet is never resent, so let go of its buffer
+void release(pktData &p) {
+  pktbuf_unref(p.buf);
+  p.buf = NULL;
+}
+
+// Packet seq goes out now, for the first time or again; log it so it can be resent if it expires
+void sent(srFlow &f, seq_t seq) {
+  pktData &p = f.window[seq];
+  p.timeSent = get_sim_time();
+  p.sends++;
+  if(f.sendLog.full()) f.sendLog.grow();
+  sendRec r = {seq, p.timeSent, p.sends};
+  f.sendLog.push(r);
+}
+
+// Send, in order, whatever the window now allows from the messages waiting for it
+void sendNew(srFlow &f) {
+  f.batch.clear();
+  while(!f.messageBuffer.empty() && (int)f.window.size() < f.cc.send_window(f.rwnd)) {
+    msg m = f.messageBuffer.pop();
+    seq_t seq = f.window.next();
+    pktData &p = f.window.push();
+    p.buf = pktbuf_alloc();
+    p.buf->pkt = makePkt(m.data, seq_wire(seq), -1);
+    p.firstSent = get_sim_time();
+    p.resent = false;
+    sent(f, seq);
+    f.batch.push_back(p.buf);
+  }
+  // Messages beyond -w count against --sndbuf
+  setbacklog(A, (int)(f.window.size() + f.messageBuffer.size()) - getwinsize());
+  if(f.batch.empty()) return;
+  tolayer3_buf_batch(A, &f.batch[0], f.batch.size()); // The whole refill goes out in one call
+  if(++f.it < 1) starttimer(A, f.rto.timeout()); // Start the physical timer if it isn't running
+}
+
+// Retransmit any packets that might be expired. Sends are logged in the order they
+// went out, so only the front of the log is looked at; records of packets that have
+// since been ackd or resent are dropped on the way
+void resendExpired(srFlow &f) {
+  f.expired.clear();
+  while(!f.sendLog.empty()) {
+    sendRec &r = f.sendLog.front();
+    if(f.window.outstanding(r.seq) && !f.window.acked(r.seq) && f.window[r.seq].sends == r.sends) {
+      int deltaTime = get_sim_time() - r.timeSent;
+      if(deltaTime < f.rto.current()) break; // Everything after it went out later
+      f.expired.push_back(r.seq);
+    }
+    f.sendLog.pop();
+  }
+  // Resend them in window order
+  seq_t base = f.window.base();
+  std::sort(f.expired.begin(), f.expired.end(), [base](seq_t a, seq_t b) { return a - base < b - base; });
+  if(!f.expired.empty()) f.cc.loss(base, f.window.next()); // Halve the window (with --cc aimd)
+  for(unsigned i=0; i<f.expired.size(); i++) {
+    f.window[f.expired[i]].resent = true;
+    sent(f, f.expired[i]);
+    tolayer3_buf(A, f.window[f.expired[i]].buf);
+  }
 }
 
 /* called from layer 5, passed the data to be sent to other side */
 void A_output(struct msg message)
 {
-  struct pktData pktDat = makePktData(message.data, ASeqnumN, -1); // Construct packet
-  if(ASeqnumN - ASeqnumFirst < getwinsize()) {
-    pktDat.wasSent = true; // Flag as sent (don't need to set for other case since its initialized to false by default)
-    tolayer3(A, pktDat.packet); // Send to layer3, set timer if it hasnt been set
-    if(++it < 1) starttimer(A, TIMEOUT); // Start first physical timer. This is only called once.
-  }
-  packets.push_back(pktDat); // Add packet to our sender view
-  ASeqnumN++; // Increase upper limit of window regardless, since we know packets buffered or not will get sent regardless
+  srFlow &f = thisFlow();
+  if(f.messageBuffer.full()) f.messageBuffer.grow(); // Only without --sndbuf
+  f.messageBuffer.push(message); // Queue behind anything already waiting
+  sendNew(f);   // Goes out now if the window has room, later otherwise
 }
 
 /* called from layer 3, when a packet arrives for layer 4 */
 void A_input(struct pkt packet)
 {
-  if(getChecksum(packet) == packet.checksum) {
-    packets[packet.seqnum].wasAckd = true; // Mark as recv'd
-    if(packet.seqnum == ASeqnumFirst) {
-      // If packets seqnum is equal to the base, move up the base to the unackd packet with the smallest seq number
-      while(!packets[ASeqnumFirst].wasAckd) ASeqnumFirst++;
-      stoptimer(A);
-      // Check window for untransmitted packets and retransmit them
-      for(int i=ASeqnumFirst; i<ASeqnumN; i++) {
-        if(!packets[i].wasSent) {
-          packets[i].wasSent = true;
-          packets[i].timeSent = get_sim_time();
-          tolayer3(A, packets[i].packet);
-        }
-      }
+  srFlow &f = thisFlow();
+  if(pkt_checksum(&packet) == packet.checksum) {
+    // ACKs can be for up to a window behind the base as well as inside the window.
+    // Marking one ackd moves the base past every ackd packet in a row after it
+    seq_t seq = seq_nearest(packet.seqnum, f.window.base());
+    if(f.window.outstanding(seq) && !f.window.acked(seq) && !f.window[seq].resent)
+      f.rto.sample(get_sim_time() - f.window[seq].firstSent); // Sent once, so this is its RTT
+    unsigned moved = f.window.ack(seq, release);
+    if(ack_delayed()) {
+      // B holds back ACKs, so its acknum says what it has in order: everything before it
+      seq_t cum = seq_nearest(packet.acknum, f.window.base());
+      while(!f.window.empty() && seq_lt(f.window.base(), cum)) moved += f.window.ack(f.window.base(), release);
     }
-    // Retransmit any packets that might be expired
-    if(ASeqnumFirst < ASeqnumN) {
-      for(int i=ASeqnumFirst; i<ASeqnumN; i++) {
-        int deltaTime = get_sim_time() - packets[i].timeSent;
-        if(deltaTime >= TIMEOUT && !packets[i].wasAckd) {
-          packets[i].timeSent = get_sim_time();
-          tolayer3(A, packets[i].packet);
-        }
-      }
+    f.rwnd = packet.rcvwnd;                  // Every ACK carries B's latest window
+    if(moved > 0) {
+      f.rto.acked();
+      f.cc.acked(moved);
+      stoptimer(A);
+      if(!f.window.empty()) starttimer(A, f.rto.timeout()); // Keep timing the new base
+      else f.it = -1;                               // Idle; A_output starts the next one
     }
+    // The window may have moved or grown; send what now fits
+    sendNew(f);
+    if(!f.window.empty()) resendExpired(f);
   }
 }
 
 /* called when A's timer goes off */
 void A_timerinterrupt()
 {
-  packets[ASeqnumFirst].timeSent = get_sim_time(); // First, update starttime for packet
-  tolayer3(A, packets[ASeqnumFirst].packet);       // Resend the base packet since the timer is tied in to the base
-  starttimer(A, TIMEOUT);                          // Restart timer
+  srFlow &f = thisFlow();
+  f.rto.backoff();                                   // Wait twice as long next time (with --rto adaptive)
+  f.cc.timeout(f.window.next());                     // Back to one packet (with --cc aimd)
+  f.window[f.window.base()].resent = true;
+  sent(f, f.window.base());                          // First, update starttime for packet
+  tolayer3_buf(A, f.window[f.window.base()].buf);    // Resend the base packet since the timer is tied in to the base
+  starttimer(A, f.rto.timeout());                  // Restart timer
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
 void A_init()
 {
+  srFlow &f = thisFlow();
+  // B must tell a packet a window ahead of its base from one a window behind
+  seq_check_window("sr", seq_space() / 2);
+  f.window.reserve(getwinsize());
+  f.messageBuffer.reserve(getsndbuf() > 0 ? getsndbuf() + getwinsize() : getwinsize());
+  f.sendLog.reserve(getwinsize());
+  f.rto.init(TIMEOUT);
+  f.cc.init();
 }
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
 
+// ACK packet seqnum. When B holds back ACKs the acknum is the next packet it
+// expects, so the ACK also covers everything held before it
+void sendAck(srFlow &f, char payload[], int seqnum) {
+  if(!ack_delayed()) {
+    tolayer3(B, makePkt(payload, seqnum, seqnum));
+    return;
+  }
+  tolayer3(B, makePkt(payload, seqnum, seq_wire(f.recvWindow.base())));
+  f.delack.sent();
+}
+
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 void B_input(struct pkt packet)
 {
-  BRcvN =  BRcvBase + getwinsize(); // Update BRcvN
-  char msg[20];
-  strncpy(msg, packet.payload, 20);
-  if(getChecksum(packet) == packet.checksum) {
+  srFlow &f = thisFlow();
+  seq_t BRcvBase = f.recvWindow.base();
+  if(pkt_checksum(&packet) == packet.checksum) {
     // Handle two cases, where seqNum is in [BRcvBase, BRcvBase+N-1], or in [BRcvBase-N, BRcvBase-1]
-    if(packet.seqnum <= BRcvN+1 && packet.seqnum >= BRcvBase) {
+    // Anything accepted beyond rcv_base + getrcvwnd(B) might not fit in the app layer
+    // once delivered, so leave it unACKed for A to resend later
+    seq_t seq = seq_nearest(packet.seqnum, BRcvBase);
+    seq_t ahead = seq - BRcvBase;  // Past the base, or huge if behind it
+    if(f.recvWindow.in_window(seq) && ahead < (seq_t)getrcvwnd(B)) {
       // If packet has not been previously received, it is buffered
-      if(recvBuffer[packet.seqnum].packet.seqnum == -1) {
-        pkt ack = makePkt(msg, packet.seqnum, packet.seqnum); // Create ACK
-        recvBuffer[packet.seqnum].packet = ack;               // Buffer ACK
-        tolayer3(B, ack);                                     // Send ACK
+      if(!f.recvWindow.have(seq)) {
+        memcpy(f.recvWindow.put(seq).payload, packet.payload, 20); // Buffer payload in its slot
+        if(!ack_delayed() || seq != BRcvBase) sendAck(f, packet.payload, packet.seqnum); // Out of order is ACKd at once
       }
-      // Send packet to upper layer if the seqnum is rcv_base
-      if(BRcvBase == packet.seqnum) {
-        tolayer5(B, packet.payload);
-        recvBuffer[packet.seqnum].wasSent = true; // Flag as being sent (to upper layer)
-        // Send any consecutive packets in [rcv_base, rcv_base+N-1]
-        for(int i=BRcvBase; i<BRcvN+1; i++) {
-          if(!recvBuffer[i+1].wasSent && recvBuffer[i+1].packet.acknum != -1) {
-            tolayer5(B, recvBuffer[i+1].packet.payload);
-            BRcvBase++;
-          } else break;
-        }
-        BRcvBase++; // Increment once here to account for the initial packet whose ack is the base
+      // Send packet to upper layer if the seqnum is rcv_base, along with every
+      // consecutive packet buffered behind it, straight out of their slots (in
+      // two runs if they wrap around the ring)
+      if(BRcvBase == seq) {
+        unsigned n = f.recvWindow.ready();
+        f.recvWindow.spans(BRcvBase, n, [](rcvSlot *slots, unsigned len) {
+          tolayer5_batch(B, slots[0].payload, len, sizeof(rcvSlot));
+        });
+        f.recvWindow.deliver(n);
+        // A packet that fills a gap is ACKd at once, one in order may wait
+        if(ack_delayed() && (n > 1 || f.delack.arrived())) sendAck(f, packet.payload, packet.seqnum);
       }
-    } else if(packet.seqnum <= BRcvBase-1 && packet.seqnum >= BRcvBase - getwinsize()) {
-      tolayer3(B, makePkt(msg, packet.seqnum, packet.seqnum));
+    } else if(BRcvBase - seq - 1 < (seq_t)getwinsize()) {
+      sendAck(f, packet.payload, packet.seqnum);
     }
   }
 }
 
+/* called when B's timer goes off */
+void B_timerinterrupt()
+{
+  srFlow &f = thisFlow();
+  // Packets have waited --ackdelay for their ACK: ACK the last one in order
+  char none[20] = {0};
+  if(f.delack.expired()) sendAck(f, none, seq_wire(f.recvWindow.base() - 1));
+}
+
 /* the following rouytine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init()
 {
-  char tmp[1] = "";
-  // Fill recv buffer with empty packets
-  for(int i=0; i<1000; i++) {
-    recvBuffer.push_back(makePktData(tmp, -1, -1));
-  }
+  srFlow &f = thisFlow();
+  // One slot per seqnum B can accept ahead of rcv_base
+  f.recvWindow.reserve(getwinsize());
+}
+
 }
+
+REGISTER_PROTOCOL("sr")
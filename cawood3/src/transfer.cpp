@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <vector>
+
+#include "../include/transfer.h"
+
+/*****************************************************************
+ Bulk transfer of a file.  The source is memory-mapped read only
+ and chunked in place; each flow keeps its own cursor into it, so
+ several flows each carry an independent copy.  Both ends hash the
+ bytes as they pass, which lets a transfer be verified without
+ keeping the delivered data around.
+******************************************************************/
+
+#define  FNV_OFFSET   0xcbf29ce484222325ULL
+#define  FNV_PRIME    0x100000001b3ULL
+
+struct xfer {
+  int sent;                    /* chunks handed to A */
+  int read;                    /* chunks read by B's application */
+  float start;                 /* first chunk handed to A */
+  float done;                  /* last chunk read at B */
+  unsigned long long src_hash; /* bytes handed to A */
+  unsigned long long dst_hash; /* bytes read at B */
+};
+
+const char *xf_path = NULL;
+const unsigned char *xf_base = NULL;   /* the mapped file */
+size_t xf_len = 0;
+int xf_nmsgs = 0;
+FILE *xf_out = NULL;
+const char *xf_out_path = NULL;
+std::vector<struct xfer> xf_flows;
+
+unsigned long long fnv1a(unsigned long long h, const unsigned char *p, size_t n)
+{
+  while (n--) {
+    h ^= *p++;
+    h *= FNV_PRIME;
+  }
+  return h;
+}
+
+int transfer_open(const char *path)
+{
+  struct stat st;
+  void *p;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    perror(path);
+    return 0;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    fprintf(stderr, "%s: empty or unreadable file\n", path);
+    close(fd);
+    return 0;
+  }
+  if ((st.st_size + 19) / 20 > 0x7fffffff) {
+    fprintf(stderr, "%s: too large to transfer\n", path);
+    close(fd);
+    return 0;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);                   /* the mapping keeps the file open */
+  if (p == MAP_FAILED) {
+    perror(path);
+    return 0;
+  }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  xf_path = path;
+  xf_base = (const unsigned char *)p;
+  xf_len = st.st_size;
+  xf_nmsgs = (int)((xf_len + 19) / 20);
+  return 1;
+}
+
+int transfer_set_output(const char *path)
+{
+  if ((xf_out = fopen(path, "wb")) == NULL) {
+    perror(path);
+    return 0;
+  }
+  xf_out_path = path;
+  return 1;
+}
+
+void transfer_init(int nflows)
+{
+  int f;
+
+  if (xf_base == NULL)
+    return;
+  xf_flows.resize(nflows);
+  for (f = 0; f < nflows; f++) {
+    xf_flows[f].sent = 0;
+    xf_flows[f].read = 0;
+    xf_flows[f].src_hash = FNV_OFFSET;
+    xf_flows[f].dst_hash = FNV_OFFSET;
+  }
+}
+
+int transfer_active()
+{
+  return xf_base != NULL;
+}
+
+int transfer_messages()
+{
+  return xf_nmsgs;
+}
+
+/* bytes of the file in chunk i; only the last one can be short */
+size_t chunk_len(int i)
+{
+  size_t off = (size_t)i * 20;
+
+  return xf_len - off < 20 ? xf_len - off : 20;
+}
+
+void transfer_next_msg(int flow, float now, struct msg *m)
+{
+  struct xfer *x = &xf_flows[flow];
+  size_t n = chunk_len(x->sent);
+
+  if (x->sent == 0)
+    x->start = now;
+  memcpy(m->data, xf_base + (size_t)x->sent * 20, n);
+  memset(m->data + n, 0, 20 - n);
+  x->src_hash = fnv1a(x->src_hash, (const unsigned char *)m->data, n);
+  x->sent++;
+}
+
+void transfer_deliver(int flow, float now, const char *data)
+{
+  struct xfer *x = &xf_flows[flow];
+  size_t n = chunk_len(x->read);
+
+  x->dst_hash = fnv1a(x->dst_hash, (const unsigned char *)data, n);
+  if (xf_out != NULL && fwrite(data, 1, n, xf_out) != n) {
+    perror(xf_out_path);
+    fclose(xf_out);
+    xf_out = NULL;             /* keep hashing, stop writing */
+  }
+  if (++x->read == xf_nmsgs)
+    x->done = now;
+}
+
+void transfer_report()
+{
+  struct xfer *x;
+  float fct;
+  int f, complete = 0;
+
+  if (xf_base == NULL)
+    return;
+  if (xf_out != NULL)
+    fclose(xf_out);
+
+  printf("\nTransfer statistics:\n");
+  printf(" file: %s, %lu bytes in %d messages\n", xf_path, (unsigned long)xf_len, xf_nmsgs);
+  for (f = 0; f < (int)xf_flows.size(); f++) {
+    x = &xf_flows[f];
+    if (x->read < xf_nmsgs) {
+      printf(" flow %d: incomplete, %d of %d messages read\n", f, x->read, xf_nmsgs);
+      continue;
+    }
+    complete++;
+    fct = x->done - x->start;
+    printf(" flow %d: completion time %f, goodput %f bytes/time unit, hash %016llx %s\n",
+           f, fct, fct > 0.0 ? xf_len / fct : 0.0, x->dst_hash,
+           x->dst_hash == x->src_hash ? "ok" : "MISMATCH");
+  }
+  printf(" %d of %d transfer(s) complete\n", complete, (int)xf_flows.size());
+}
@@ -0,0 +1,59 @@
+#ifndef ACKPOLICY_H_
+#define ACKPOLICY_H_
+
+#include "simulator.h"
+
+/* Receiver ACK policy, picked with --ackevery and --ackdelay.  B holds  */
+/* back the ACK for packets that arrive in order until getackevery() of  */
+/* them are waiting, or until getackdelay() time units after the first   */
+/* of them on B's timer, whichever comes first.  One ACK then covers     */
+/* them all.  A packet out of order, a duplicate, or one that fills a    */
+/* gap is acknowledged at once, since A needs to hear about it.  Without */
+/* either option B ACKs every packet as it arrives, as it always has.    */
+/*                                                                       */
+/* --ackevery n on its own relies on A's retransmissions to get the last */
+/* ACKs of a run out, so it wants n below the window or an --ackdelay.   */
+
+/* true if B may hold back ACKs in this run */
+inline bool ack_delayed()
+{
+  return getackevery() > 1 || getackdelay() > 0;
+}
+
+struct delayed_ack {
+  int held = 0;            /* in-order packets not yet acknowledged */
+  bool timing = false;     /* B's timer is running for them */
+
+  /* an in-order packet was taken; true if its ACK should go out now */
+  bool arrived()
+  {
+    if (!ack_delayed())
+      return true;
+    held++;
+    if (getackevery() > 0 && held >= getackevery())
+      return true;
+    if (getackdelay() > 0 && !timing) {
+      starttimer(1, getackdelay());   /* B */
+      timing = true;
+    }
+    return false;
+  }
+
+  /* an ACK covering everything held is going out */
+  void sent()
+  {
+    held = 0;
+    if (timing)
+      stoptimer(1);
+    timing = false;
+  }
+
+  /* B's timer went off: true if there is an ACK to send */
+  bool expired()
+  {
+    timing = false;
+    return held > 0;
+  }
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include "simulator.h"
+
+/* Packet checksums shared by all the protocols.  A checksum covers every */
+/* field of a packet except the checksum itself.  The algorithm is picked */
+/* once per run with --checksum; the default is the byte-add the original */
+/* protocols used, so existing runs are unchanged.                        */
+
+#define  CKSUM_SUM      0   /* sum of seqnum, acknum, rcvwnd and payload bytes */
+#define  CKSUM_INET     1   /* RFC 1071 16-bit one's complement sum */
+#define  CKSUM_CRC32C   2   /* Castagnoli CRC, SSE4.2 instruction when available */
+#define  CKSUM_NALGS    3
+
+/* arg is one of: sum, inet, crc32c */
+int checksum_set(const char *arg);
+int checksum_algorithm();
+const char *checksum_name(int alg);
+
+/* true if CRC32C runs on the SSE4.2 crc32 instruction on this CPU */
+int checksum_hw();
+
+/* checksum of p under the selected algorithm, or under alg */
+int pkt_checksum(const struct pkt *p);
+int pkt_checksum_alg(int alg, const struct pkt *p);
+
+/* true if p's checksum field does not match its contents */
+int pkt_corrupt(const struct pkt *p);
+
+/* check n packets at once, interleaving them so independent CRCs overlap */
+/* in the pipeline.  bad[i] is set to pkt_corrupt(pkts[i]) if bad is not  */
+/* NULL; returns the number of corrupt packets.  Only cksum_bench uses    */
+/* it: the simulator hands a receiver one packet per upcall, and each    */
+/* has to be checked as it arrives to decide what to ACK, so there is no */
+/* batch to verify.                                                       */
+int pkt_verify_batch(const struct pkt *const *pkts, int n, unsigned char *bad);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+#include <stdio.h>
+
+#include "simulator.h"
+
+/* A transport protocol is the set of routines the simulator calls:      */
+/* A_output, A_input, A_timerinterrupt, A_init, B_input,                 */
+/* B_timerinterrupt and B_init.  A protocol file keeps its routines and  */
+/* state in an anonymous namespace and ends with                         */
+/* REGISTER_PROTOCOL("name"), so any number of protocols can be linked   */
+/* into one simulator and picked with --protocol.                        */
+/*                                                                       */
+/* The event loop, protocol<P>::run(), is instantiated for each protocol */
+/* in the protocol's own file, so every upcall is a direct call the      */
+/* compiler can inline rather than one through a pointer.                */
+
+/* what sim_next() wants the transport to do */
+#define  UP_A_OUTPUT   0    /* take a message from layer 5 at A */
+#define  UP_A_INPUT    1    /* a packet arrived at A */
+#define  UP_B_INPUT    2    /* a packet arrived at B */
+#define  UP_A_TIMER    3    /* A's timer went off */
+#define  UP_B_TIMER    4    /* B's timer went off */
+
+struct upcall {
+   int type;
+   struct msg msg;          /* UP_A_OUTPUT */
+   struct pkt *pkt;         /* UP_A_INPUT, UP_B_INPUT: good until the next sim_next() */
+};
+
+/* The simulator's half of the event loop */
+void sim_enter_flow(int f);         /* run the next routine as flow f */
+int sim_next(struct upcall *u);     /* run events up to the next upcall; 0 when the run is over */
+
+/* CRTP base: P supplies the seven routines as static members */
+template <class P> struct protocol {
+   static void run()
+   {
+      struct upcall u;
+      int f;
+
+      for (f = 0; f < get_nflows(); f++) {
+         sim_enter_flow(f);
+         P::A_init();
+      }
+      for (f = 0; f < get_nflows(); f++) {
+         sim_enter_flow(f);
+         P::B_init();
+      }
+      while (sim_next(&u)) {
+         switch (u.type) {
+            case UP_A_OUTPUT:  P::A_output(u.msg);    break;
+            case UP_A_INPUT:   P::A_input(*u.pkt);    break;
+            case UP_B_INPUT:   P::B_input(*u.pkt);    break;
+            case UP_A_TIMER:   P::A_timerinterrupt(); break;
+            case UP_B_TIMER:   P::B_timerinterrupt(); break;
+         }
+      }
+   }
+};
+
+/* Registry of the protocols linked into this binary, kept sorted by name */
+struct protocol_entry {
+   const char *name;
+   void (*run)();
+   int selected;                   /* picked by --protocol */
+   struct protocol_entry *next;
+};
+
+void register_protocol(struct protocol_entry *p);
+struct protocol_entry *protocol_list();
+struct protocol_entry *find_protocol(const char *name);
+int select_protocols(const char *arg);  /* "a,b,..." or "all"; how many, 0 on error */
+void list_protocols(FILE *fp);
+
+template <class P> struct protocol_registrar {
+   struct protocol_entry entry;
+
+   protocol_registrar(const char *name)
+   {
+      entry.name = name;
+      entry.run = P::run;
+      entry.selected = 0;
+      register_protocol(&entry);
+   }
+};
+
+/* Builds that link several source trees together name each tree's */
+/* protocols apart, e.g. -DPROTOCOL_TREE='"cawood3/"'               */
+#ifndef PROTOCOL_TREE
+#define PROTOCOL_TREE ""
+#endif
+
+/* at the end of a protocol file, after its anonymous namespace */
+#define REGISTER_PROTOCOL(name)                                          \
+   namespace {                                                           \
+   struct transport : protocol<transport> {                              \
+      static void A_output(struct msg m)  { ::A_output(m); }             \
+      static void A_input(struct pkt p)   { ::A_input(p); }              \
+      static void A_timerinterrupt()      { ::A_timerinterrupt(); }      \
+      static void A_init()                { ::A_init(); }                \
+      static void B_input(struct pkt p)   { ::B_input(p); }              \
+      static void B_timerinterrupt()      { ::B_timerinterrupt(); }      \
+      static void B_init()                { ::B_init(); }                \
+   };                                                                    \
+   protocol_registrar<transport> registrar(PROTOCOL_TREE name);          \
+   }
+
+#endif
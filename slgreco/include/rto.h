@@ -0,0 +1,44 @@
+#ifndef RTO_H_
+#define RTO_H_
+
+/* Retransmission timeouts.  Each protocol has its own fixed TIMEOUT,   */
+/* and without --rto that is all it uses.  With --rto adaptive, each    */
+/* flow's A estimates its timeout from the round trips it measures,     */
+/* as in RFC 6298:                                                      */
+/*   SRTT <- 7/8 SRTT + 1/8 R,  RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R|   */
+/*   RTO = SRTT + 4 RTTVAR, kept within [min, max]                      */
+/* starting from TIMEOUT until the first sample.  A packet that was     */
+/* sent more than once gives no sample, since its ACK could be for any  */
+/* of the copies (Karn).  Each timeout doubles the RTO, and the next    */
+/* ACK for new data takes it back to SRTT + 4 RTTVAR, as Linux does,    */
+/* rather than waiting for a packet sent only once to be ACKed.         */
+/* --rto fixed keeps TIMEOUT but still measures, so the two can be      */
+/* compared in the report.                                              */
+
+#define  RTO_FIXED      0
+#define  RTO_ADAPTIVE   1
+
+/* arg is one of: fixed, adaptive[,min[,max]] */
+int rto_set(const char *arg);
+int rto_mode();
+
+/* one per flow, kept by the sender */
+struct rto_estimator {
+  float fixed = 0;         /* the protocol's TIMEOUT */
+  float srtt = 0;
+  float rttvar = 0;
+  float rto = 0;           /* current timeout, backed off or not */
+  bool measured = false;   /* srtt and rttvar hold a sample */
+
+  void init(float timeout);
+  float timeout();         /* for starttimer(); counted in the report */
+  float current() const;   /* the same, to test a packet's age */
+  void sample(float rtt);  /* round trip of a packet sent exactly once */
+  void backoff();          /* the retransmission timer went off */
+  void acked();            /* an ACK covered new data: undo any backoff */
+};
+
+/* distributions of the RTT samples and of the timeouts used */
+void rto_report();
+
+#endif
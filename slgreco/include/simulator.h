@@ -18,24 +18,59 @@ struct pkt {
    int acknum;
    int checksum;
    char payload[20];
+   int rcvwnd;             /* messages B can still accept, advertised in ACKs */
 };
 
-/* Implementation framework interface */
-void A_output(struct msg message);
-void B_output(struct msg message);
-void A_input(struct pkt packet);
-void A_timerinterrupt();
-void A_init();
+/* a pooled, reference-counted packet.  A transport that keeps packets */
+/* for retransmission can hold them in these and send them with        */
+/* tolayer3_buf(): the channel then shares the buffer instead of       */
+/* copying it, and copies it only if it is about to corrupt it.        */
+struct pktbuf {
+   struct pkt pkt;
+   int refs;
+   struct pktbuf *next;    /* pool free list */
+};
+
+/* what made a transport resend, for count_recovery() */
+#define RECOVERY_TIMEOUT 0
+#define RECOVERY_FAST    1     /* duplicate ACKs */
+#define RECOVERY_REPAIR  2     /* more coded symbols, on the receiver's feedback */
 
-void B_input(struct pkt packet);
-void B_init();
+/* getrcvwnd() when the receiving application's buffer is unbounded */
+#define RCVWND_UNLIMITED 1000000
+
+/* The routines a protocol implements (A_output, A_input, */
+/* A_timerinterrupt, A_init, B_input, B_timerinterrupt,   */
+/* B_init) are listed in protocol.h.                      */
 
 /* Simulator API */
 void starttimer(int AorB, float increment);
 void stoptimer(int AorB);
 void tolayer3(int AorB, struct pkt packet);
+void tolayer3_batch(int AorB, const struct pkt *packets, int n);  /* n tolayer3() calls in one */
+void tolayer3_buf(int AorB, struct pktbuf *b);     /* send without copying; the caller keeps its reference */
+void tolayer3_buf_batch(int AorB, struct pktbuf *const *bufs, int n);
 void tolayer5(int AorB, char datasent[]);
+void tolayer5_batch(int AorB, const char *data, int n, int stride);  /* n in-order messages, stride bytes apart */
 int getwinsize();
+int getseqbits();          /* sequence number bits on the wire, 0 for all 32 */
+int getdupacks();          /* duplicate ACKs that trigger a fast retransmit, 0 for none */
+int getackevery();         /* B ACKs every nth in-order packet, 0 if not set (see ackpolicy.h) */
+float getackdelay();       /* B holds an ACK at most this long, 0 if not set */
+void count_recovery(int AorB, int how);  /* the transport resent lost packets */
 float get_sim_time();
+int getsndbuf();           /* messages A may buffer, 0 for unlimited */
+void blocklayer5(int AorB);    /* send buffer full: hold layer 5 arrivals */
+void unblocklayer5(int AorB);  /* room again: resume layer 5 arrivals */
+void setbacklog(int AorB, int n);  /* n messages wait for the window: block at getsndbuf(), else unblock */
+int getrcvwnd(int AorB);   /* free space in the receiving application's buffer */
+int get_flow();            /* flow (A/B pair) whose routine is running */
+int get_nflows();          /* number of flows in this run */
+
+/* Packet buffers */
+struct pktbuf *pktbuf_alloc();                  /* one reference, contents unset */
+struct pktbuf *pktbuf_ref(struct pktbuf *b);    /* take another reference */
+void pktbuf_unref(struct pktbuf *b);            /* drop one; the last frees it */
+struct pkt *pktbuf_unshare(struct pktbuf **bp); /* private copy before writing */
 
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include "channel.h"
+
+/* A topology of endpoints and store-and-forward routers, loaded from a  */
+/* file with one duplex link per line:                                   */
+/*                                                                        */
+/*     link <node> <node> <loss> <delay> <bandwidth> <queue>              */
+/*                                                                        */
+/*   loss       probability a packet is lost crossing the link            */
+/*   delay      propagation delay in time units                           */
+/*   bandwidth  packets per time unit, 0 for unlimited                    */
+/*   queue      packets held per direction, 0 for unlimited               */
+/*                                                                        */
+/* Nodes named A and B are the endpoints every flow attaches to; any     */
+/* other name is a router.  Each direction of a link keeps its own       */
+/* queue.  Packets follow the fewest-hop path between the endpoints.     */
+/* Blank lines and lines starting with '#' are skipped.                   */
+
+int topology_load(const char *path);
+int topology_active();
+
+/* send a packet sent by AorB across hop number hop of its path, starting */
+/* at time now.  Returns 0 if it is dropped or lost, otherwise the time   */
+/* it reaches the far node in arrive, and whether that node is the        */
+/* destination endpoint in last.                                          */
+int topology_hop(int AorB, int hop, float now, float *arrive, int *last);
+
+void topology_report(float now);
+
+#endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+
+#include "../include/channel.h"
+
+/*****************************************************************
+ Loss and corruption models for the emulated layer 3.
+
+ Loss is either the original independent draw against -l, or a
+ Gilbert-Elliott chain with a good and a bad state, stepped once per
+ packet offered in each direction. Corruption is either the original
+ fixed rewrite against -c, or a bit error rate applied to every bit of
+ the packet, so bigger packets see proportionally more flipped bits.
+ A direction with a trace attached ignores all of the above and takes
+ loss, delay and corruption for each packet from the next trace record.
+ Ahead of all of this, packets from every flow going A->B can be made
+ to queue for a shared bottleneck that sends one packet per 1/rate.
+******************************************************************/
+
+extern int TRACE;
+extern float lossprob;
+extern float corruptprob;
+
+int loss_model = LOSS_BERNOULLI;
+int corrupt_model = CORRUPT_FIXED;
+
+struct gilbert_params gilbert;
+double ber = 0.0;
+
+/* per-direction channel state, indexed by the sending entity */
+int ge_bad[2];             /* Gilbert-Elliott chain is in the bad state */
+int prev_lost[2];          /* previous packet in this direction was lost */
+
+/* trace replay, indexed by the sending entity */
+int use_trace[2];
+struct trace_reader traces[2];
+struct trace_rec cur_rec[2];   /* record for the packet being sent */
+double tr_delay_sum[2];
+float tr_delay_max[2];
+int tr_delivered[2];
+
+/* shared A->B bottleneck, unused while its rate is 0 */
+struct link bottleneck;
+
+/* statistics */
+int ch_offered = 0;        /* packets offered to the channel */
+int ch_lost = 0;           /* packets lost */
+int ch_bursts = 0;         /* runs of consecutive losses */
+int ch_bad_pkts = 0;       /* packets offered while in the bad state */
+int ch_corrupt = 0;        /* packets with at least one flipped bit */
+long ch_bitflips = 0;      /* total bits flipped */
+
+int channel_set_gilbert(const char *arg)
+{
+  struct gilbert_params g;
+  int n;
+
+  g.loss_good = 0.0;
+  g.loss_bad = 1.0;
+  n = sscanf(arg, "%f,%f,%f,%f", &g.p_gb, &g.p_bg, &g.loss_good, &g.loss_bad);
+  if (n < 2)
+    return 0;
+  if (g.p_gb < 0.0 || g.p_gb > 1.0 || g.p_bg < 0.0 || g.p_bg > 1.0 ||
+      g.loss_good < 0.0 || g.loss_good > 1.0 ||
+      g.loss_bad < 0.0 || g.loss_bad > 1.0)
+    return 0;
+
+  gilbert = g;
+  loss_model = LOSS_GILBERT;
+  return 1;
+}
+
+int channel_set_ber(const char *arg)
+{
+  char *end;
+  double val = strtod(arg, &end);
+
+  if (end == arg || *end != '\0' || val < 0.0 || val > 1.0)
+    return 0;
+
+  ber = val;
+  corrupt_model = CORRUPT_BER;
+  return 1;
+}
+
+int channel_set_trace(int AorB, const char *path)
+{
+  if (!trace_open(&traces[AorB], path))
+    return 0;
+  use_trace[AorB] = 1;
+  return 1;
+}
+
+int channel_set_bottleneck(const char *arg)
+{
+  float rate;
+  int queue = 0;
+
+  if (sscanf(arg, "%f,%d", &rate, &queue) < 1 || rate <= 0.0 || queue < 0)
+    return 0;
+  bottleneck.rate = rate;
+  bottleneck.queue = queue;
+  return 1;
+}
+
+/* queue a packet on a link.  The link sends packets back to back, so the */
+/* backlog at time now is however many service times remain before free. */
+/* Returns 0 if the queue is full and the packet is dropped, otherwise    */
+/* the time the packet has finished leaving the link in depart.           */
+int link_admit(struct link *l, float now, float *depart)
+{
+  double service;
+  int backlog;
+
+  *depart = now;
+  if (l->rate <= 0.0) {
+    l->sent++;
+    return 1;
+  }
+
+  service = 1.0 / l->rate;
+  if (l->free < now)
+    l->free = now;
+  backlog = (int)ceil((l->free - now) / service - 1e-6);
+  if (l->queue > 0 && backlog >= l->queue) {
+    l->drops++;
+    return 0;
+  }
+  l->free += service;
+  l->sent++;
+  if (backlog + 1 > l->maxq)
+    l->maxq = backlog + 1;
+  *depart = (float)l->free;
+  return 1;
+}
+
+int channel_admit(int AorB, float now, float *depart)
+{
+  if (AorB != 0 || bottleneck.rate <= 0.0) {
+    *depart = now;
+    return 1;
+  }
+  return link_admit(&bottleneck, now, depart);
+}
+
+int channel_lose(int AorB)
+{
+  int lost;
+
+  ch_offered++;
+  if (use_trace[AorB]) {
+    trace_next(&traces[AorB], &cur_rec[AorB]);
+    lost = cur_rec[AorB].lost;
+  }
+  else if (loss_model == LOSS_GILBERT) {
+    /* step the chain first, then draw against the new state's loss rate */
+    if (ge_bad[AorB]) {
+      if (jimsrand() < gilbert.p_bg)
+        ge_bad[AorB] = 0;
+    }
+    else if (jimsrand() < gilbert.p_gb)
+      ge_bad[AorB] = 1;
+
+    if (ge_bad[AorB])
+      ch_bad_pkts++;
+    lost = jimsrand() < (ge_bad[AorB] ? gilbert.loss_bad : gilbert.loss_good);
+  }
+  else
+    lost = jimsrand() < lossprob;
+
+  if (lost) {
+    ch_lost++;
+    if (!prev_lost[AorB])
+      ch_bursts++;
+  }
+  prev_lost[AorB] = lost;
+  return lost;
+}
+
+/* arrival time of a packet sent now, given the latest arrival time of */
+/* packets already in flight to the same side.  The medium does not    */
+/* reorder, so a trace delay that would overtake is held behind it.    */
+float channel_arrival(int AorB, float now, float lastime)
+{
+  float t;
+
+  if (!use_trace[AorB])
+    return lastime + 1 + 9*jimsrand();
+
+  t = now + cur_rec[AorB].delay;
+  tr_delivered[AorB]++;
+  tr_delay_sum[AorB] += cur_rec[AorB].delay;
+  if (cur_rec[AorB].delay > tr_delay_max[AorB])
+    tr_delay_max[AorB] = cur_rec[AorB].delay;
+  if (t <= lastime)
+    t = nextafterf(lastime, FLT_MAX);
+  return t;
+}
+
+/* uniform on (0,1] to double precision, from two rand() draws.  A float */
+/* from jimsrand() has 24 bits, too coarse for the gaps a ber of 1e-6 to  */
+/* 1e-9 needs: a packet is flipped with a probability of only ~1e-7.     */
+double drand53()
+{
+  uint64_t hi = (uint64_t)rand(), lo = (uint64_t)rand();   /* 31 bits each */
+
+  return (double)(((hi << 22) ^ lo) & ((1ULL << 53) - 1)) / 9007199254740992.0 +
+         1.0 / 9007199254740992.0;
+}
+
+/* flip each bit of the packet independently with probability ber.  Rather */
+/* than drawing once per bit, skip ahead by geometrically distributed gaps */
+/* between flips, so the cost is proportional to the number of errors.    */
+int flip_bits(struct pktbuf **bp)
+{
+  unsigned char *bytes = NULL;
+  long nbits = (long)sizeof(struct pkt) * 8;
+  long pos = -1;
+  int flips = 0;
+  double u, gap;
+
+  if (ber <= 0.0)
+    return 0;
+
+  while (1) {
+    if (ber >= 1.0)
+      pos += 1;
+    else {
+      u = drand53();
+      gap = floor(log(u) / log1p(-ber));
+      if (gap >= nbits)
+        break;             /* past the end, and long may not hold it */
+      pos += 1 + (long)gap;
+    }
+    if (pos >= nbits)
+      break;
+    if (bytes == NULL)
+      bytes = (unsigned char *)pktbuf_unshare(bp);
+    bytes[pos / 8] ^= (unsigned char)(1 << (pos % 8));
+    flips++;
+  }
+  return flips;
+}
+
+int channel_corrupt(int AorB, struct pktbuf **bp)
+{
+  struct pkt *packet;
+  float x;
+  int flips;
+
+  if (use_trace[AorB]) {
+    if (cur_rec[AorB].corrupt == 0)
+      return 0;
+    packet = pktbuf_unshare(bp);
+    switch (cur_rec[AorB].corrupt) {
+      case 1:  packet->payload[0]='Z';
+               break;
+      case 2:  packet->seqnum = 999999;
+               break;
+      default: packet->acknum = 999999;
+               break;
+    }
+    ch_corrupt++;
+    return 1;
+  }
+
+  if (corrupt_model == CORRUPT_BER) {
+    flips = flip_bits(bp);
+    if (flips == 0)
+      return 0;
+    ch_corrupt++;
+    ch_bitflips += flips;
+    if (TRACE>2)
+      printf("          TOLAYER3: %d bit(s) flipped\n", flips);
+    return 1;
+  }
+
+  if (jimsrand() < corruptprob) {
+    ch_corrupt++;
+    packet = pktbuf_unshare(bp);
+    if ( (x = jimsrand()) < .75)
+       packet->payload[0]='Z';   /* corrupt payload */
+      else if (x < .875)
+       packet->seqnum = 999999;
+      else
+       packet->acknum = 999999;
+    return 1;
+  }
+  return 0;
+}
+
+void channel_report(float now)
+{
+  int i;
+
+  if (loss_model == LOSS_BERNOULLI && corrupt_model == CORRUPT_FIXED &&
+      !use_trace[0] && !use_trace[1] && bottleneck.rate <= 0.0)
+    return;
+
+  printf("\nChannel statistics:\n");
+  if (bottleneck.rate > 0.0)
+    printf(" bottleneck: rate %f, queue %d, sent %d, dropped %d, max backlog %d, utilization %f\n",
+           bottleneck.rate, bottleneck.queue, bottleneck.sent, bottleneck.drops,
+           bottleneck.maxq, now > 0.0 ? bottleneck.sent / (bottleneck.rate * now) : 0.0);
+  for (i=0; i<2; i++) {
+    if (!use_trace[i])
+      continue;
+    printf(" trace %s (%s): %ld records replayed, %d wrap(s), mean delay %f, max delay %f\n",
+           traces[i].name, i == 0 ? "A->B" : "B->A", traces[i].records, traces[i].wraps,
+           tr_delivered[i] ? tr_delay_sum[i]/tr_delivered[i] : 0.0, tr_delay_max[i]);
+    trace_close(&traces[i]);
+  }
+  if (loss_model == LOSS_GILBERT)
+    printf(" loss model: gilbert-elliott p_gb=%f p_bg=%f loss_good=%f loss_bad=%f\n",
+           gilbert.p_gb, gilbert.p_bg, gilbert.loss_good, gilbert.loss_bad);
+  else
+    printf(" loss model: bernoulli p=%f\n", lossprob);
+  printf(" offered: %d, lost: %d (%f), bad-state packets: %d\n",
+         ch_offered, ch_lost, ch_offered ? (float)ch_lost/ch_offered : 0.0,
+         ch_bad_pkts);
+  printf(" loss bursts: %d, mean burst length: %f\n",
+         ch_bursts, ch_bursts ? (float)ch_lost/ch_bursts : 0.0);
+  if (corrupt_model == CORRUPT_BER)
+    printf(" corruption model: ber=%g, corrupted: %d, bits flipped: %ld\n",
+           ber, ch_corrupt, ch_bitflips);
+  else
+    printf(" corruption model: fixed p=%f, corrupted: %d\n",
+           corruptprob, ch_corrupt);
+}
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define  CKSUM_X86
+#endif
+
+#include "../include/checksum.h"
+
+/*****************************************************************
+ The covered bytes are the 8 in front of the checksum field (seqnum
+ and acknum) and the 24 after it (payload and rcvwnd).  The SSE4.2
+ path reads them as four 64-bit words; everything else goes byte by
+ byte or 16 bits at a time.  CRC32C uses the reflected Castagnoli
+ polynomial, the same one as iSCSI and ext4, with the usual ~0
+ preset and final inversion.
+******************************************************************/
+
+#define  CRC32C_POLY   0x82f63b78u
+
+static_assert(offsetof(struct pkt, checksum) == 8 &&
+              offsetof(struct pkt, payload) == 12 &&
+              offsetof(struct pkt, rcvwnd) == 32 &&
+              sizeof(struct pkt) == 36,
+              "checksum.cpp assumes the packet layout in simulator.h");
+
+#define  HEAD_LEN   8      /* seqnum, acknum */
+#define  TAIL_OFF   12     /* payload, rcvwnd */
+#define  TAIL_LEN   24
+
+int ck_alg = CKSUM_SUM;
+int ck_hw = -1;                    /* -1 until the CPU has been asked */
+uint32_t ck_table[256];
+int ck_table_ready = 0;
+
+int checksum_set(const char *arg)
+{
+  int alg;
+
+  for (alg = 0; alg < CKSUM_NALGS; alg++)
+    if (strcmp(arg, checksum_name(alg)) == 0) {
+      ck_alg = alg;
+      return 1;
+    }
+  return 0;
+}
+
+int checksum_algorithm()
+{
+  return ck_alg;
+}
+
+const char *checksum_name(int alg)
+{
+  static const char *names[] = { "sum", "inet", "crc32c" };
+
+  return alg >= 0 && alg < CKSUM_NALGS ? names[alg] : "unknown";
+}
+
+int checksum_hw()
+{
+  if (ck_hw < 0) {
+#ifdef CKSUM_X86
+    ck_hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#else
+    ck_hw = 0;
+#endif
+  }
+  return ck_hw;
+}
+
+uint32_t sum_bytes(const struct pkt *p)
+{
+  uint32_t s = (uint32_t)p->seqnum + (uint32_t)p->acknum + (uint32_t)p->rcvwnd;
+  int i;
+
+  for (i = 0; i < 20; i++)
+    s += (uint32_t)(int)p->payload[i];   /* payload bytes are signed, as before */
+  return s;
+}
+
+uint32_t inet_add(uint32_t s, const unsigned char *b, int len)
+{
+  uint16_t w;
+  int i;
+
+  for (i = 0; i < len; i += 2) {
+    memcpy(&w, b + i, 2);
+    s += w;
+  }
+  return s;
+}
+
+uint32_t inet_sum(const struct pkt *p)
+{
+  const unsigned char *b = (const unsigned char *)p;
+  uint32_t s = 0;
+
+  s = inet_add(s, b, HEAD_LEN);
+  s = inet_add(s, b + TAIL_OFF, TAIL_LEN);
+  while (s >> 16)
+    s = (s & 0xffff) + (s >> 16);
+  return ~s & 0xffff;
+}
+
+void crc32c_table()
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (k = 0; k < 8; k++)
+      c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    ck_table[i] = c;
+  }
+  ck_table_ready = 1;
+}
+
+uint32_t crc32c_sw_add(uint32_t c, const unsigned char *b, int len)
+{
+  while (len--)
+    c = ck_table[(c ^ *b++) & 0xff] ^ (c >> 8);
+  return c;
+}
+
+uint32_t crc32c_sw(const struct pkt *p)
+{
+  const unsigned char *b = (const unsigned char *)p;
+  uint32_t c = 0xffffffffu;
+
+  if (!ck_table_ready)
+    crc32c_table();
+  c = crc32c_sw_add(c, b, HEAD_LEN);
+  c = crc32c_sw_add(c, b + TAIL_OFF, TAIL_LEN);
+  return ~c;
+}
+
+#ifdef CKSUM_X86
+/* the covered bytes of p as four 64-bit words */
+static inline void crc_words(const struct pkt *p, uint64_t w[4])
+{
+  const unsigned char *b = (const unsigned char *)p;
+
+  memcpy(&w[0], b, HEAD_LEN);
+  memcpy(&w[1], b + TAIL_OFF, TAIL_LEN);
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(const struct pkt *p)
+{
+  uint64_t w[4], c = 0xffffffffu;
+
+  crc_words(p, w);
+  c = _mm_crc32_u64(c, w[0]);
+  c = _mm_crc32_u64(c, w[1]);
+  c = _mm_crc32_u64(c, w[2]);
+  c = _mm_crc32_u64(c, w[3]);
+  return ~(uint32_t)c;
+}
+
+/* crc32 has a latency of three cycles but issues every cycle, so four */
+/* packets' CRCs are run side by side rather than one after the other. */
+__attribute__((target("sse4.2")))
+int crc32c_hw_batch(const struct pkt *const *pkts, int n, unsigned char *bad)
+{
+  uint64_t w[4][4], c[4];
+  int i, k, j, nbad = 0;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    for (k = 0; k < 4; k++) {
+      crc_words(pkts[i+k], w[k]);
+      c[k] = 0xffffffffu;
+    }
+    for (j = 0; j < 4; j++) {
+      c[0] = _mm_crc32_u64(c[0], w[0][j]);
+      c[1] = _mm_crc32_u64(c[1], w[1][j]);
+      c[2] = _mm_crc32_u64(c[2], w[2][j]);
+      c[3] = _mm_crc32_u64(c[3], w[3][j]);
+    }
+    for (k = 0; k < 4; k++) {
+      j = pkts[i+k]->checksum != (int)~(uint32_t)c[k];
+      if (bad != NULL)
+        bad[i+k] = j;
+      nbad += j;
+    }
+  }
+  for (; i < n; i++) {
+    j = pkts[i]->checksum != (int)crc32c_hw(pkts[i]);
+    if (bad != NULL)
+      bad[i] = j;
+    nbad += j;
+  }
+  return nbad;
+}
+#endif
+
+int pkt_checksum_alg(int alg, const struct pkt *p)
+{
+  switch (alg) {
+    case CKSUM_INET:   return (int)inet_sum(p);
+    case CKSUM_CRC32C:
+#ifdef CKSUM_X86
+                       if (checksum_hw())
+                         return (int)crc32c_hw(p);
+#endif
+                       return (int)crc32c_sw(p);
+    default:           return (int)sum_bytes(p);
+  }
+}
+
+int pkt_checksum(const struct pkt *p)
+{
+  return pkt_checksum_alg(ck_alg, p);
+}
+
+int pkt_corrupt(const struct pkt *p)
+{
+  return p->checksum != pkt_checksum(p);
+}
+
+int pkt_verify_batch(const struct pkt *const *pkts, int n, unsigned char *bad)
+{
+  int i, j, nbad = 0;
+
+#ifdef CKSUM_X86
+  if (ck_alg == CKSUM_CRC32C && checksum_hw())
+    return crc32c_hw_batch(pkts, n, bad);
+#endif
+  for (i = 0; i < n; i++) {
+    j = pkt_corrupt(pkts[i]);
+    if (bad != NULL)
+      bad[i] = j;
+    nbad += j;
+  }
+  return nbad;
+}
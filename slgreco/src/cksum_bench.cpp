@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "../include/checksum.h"
+
+/*****************************************************************
+ Checksum benchmark, built with "make bench".  For each algorithm
+ it times computing and batch-verifying a window of random packets,
+ then damages packets in several ways and counts how often the
+ damage goes unnoticed.  It does not run the simulator.
+
+   usage: cksum_bench [packets [trials]]
+******************************************************************/
+
+#define  NCOVERED  32
+
+/* byte offsets the checksum covers: everything but the checksum field */
+int covered[NCOVERED];
+
+struct damage {
+  const char *name;
+  void (*apply)(struct pkt *p);
+};
+
+unsigned char *bytes(struct pkt *p)
+{
+  return (unsigned char *)p;
+}
+
+void flip(struct pkt *p, int bit)
+{
+  bytes(p)[covered[bit / 8]] ^= 1 << (bit % 8);
+}
+
+/* k distinct random bits */
+void flip_bits(struct pkt *p, int k)
+{
+  int used[NCOVERED * 8] = {0};
+  int bit;
+
+  while (k > 0) {
+    bit = rand() % (NCOVERED * 8);
+    if (used[bit])
+      continue;
+    used[bit] = 1;
+    flip(p, bit);
+    k--;
+  }
+}
+
+void flip1(struct pkt *p) { flip_bits(p, 1); }
+void flip2(struct pkt *p) { flip_bits(p, 2); }
+void flip3(struct pkt *p) { flip_bits(p, 3); }
+void flip8(struct pkt *p) { flip_bits(p, 8); }
+
+/* a run of up to 32 bits, first and last always flipped */
+void burst(struct pkt *p)
+{
+  int len = 2 + rand() % 31;
+  int start = rand() % (NCOVERED * 8 - len + 1);
+  int i;
+
+  flip(p, start);
+  flip(p, start + len - 1);
+  for (i = start + 1; i < start + len - 1; i++)
+    if (rand() & 1)
+      flip(p, i);
+}
+
+/* two covered bytes with different values trade places */
+void swap_bytes(struct pkt *p)
+{
+  unsigned char *b = bytes(p), t;
+  int i, j;
+
+  do {
+    i = covered[rand() % NCOVERED];
+    j = covered[rand() % NCOVERED];
+  } while (b[i] == b[j]);
+  t = b[i]; b[i] = b[j]; b[j] = t;
+}
+
+/* two 16-bit words trade places, the reordering a one's complement sum misses */
+void swap_words(struct pkt *p)
+{
+  unsigned char *b = bytes(p), t[2];
+  int i, j;
+
+  do {
+    i = covered[2 * (rand() % (NCOVERED / 2))];
+    j = covered[2 * (rand() % (NCOVERED / 2))];
+  } while (memcmp(b + i, b + j, 2) == 0);
+  memcpy(t, b + i, 2); memcpy(b + i, b + j, 2); memcpy(b + j, t, 2);
+}
+
+/* what the simulator's -c corruption does */
+void fixed(struct pkt *p)
+{
+  float x = (float)rand() / RAND_MAX;
+
+  if (x < .75)
+    p->payload[0] = p->payload[0] == 'Z' ? 'Y' : 'Z';   /* always a change */
+  else if (x < .875)
+    p->seqnum = p->seqnum == 999999 ? 0 : 999999;
+  else
+    p->acknum = p->acknum == 999999 ? 0 : 999999;
+}
+
+struct damage damages[] = {
+  { "1 bit",      flip1 },
+  { "2 bits",     flip2 },
+  { "3 bits",     flip3 },
+  { "8 bits",     flip8 },
+  { "burst<=32",  burst },
+  { "byte swap",  swap_bytes },
+  { "word swap",  swap_words },
+  { "sim -c",     fixed },
+};
+#define  NDAMAGES  (int)(sizeof(damages) / sizeof(damages[0]))
+
+/* a packet the way the protocols build them: small seqnum, letters */
+void random_pkt(struct pkt *p, int seq)
+{
+  int i;
+
+  p->seqnum = seq;
+  p->acknum = rand() % 64;
+  p->rcvwnd = rand() % 2 ? RCVWND_UNLIMITED : rand() % 50;
+  for (i = 0; i < 20; i++)
+    p->payload[i] = 'a' + rand() % 26;
+}
+
+double now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+  int npkts = argc > 1 ? atoi(argv[1]) : 1024;
+  int trials = argc > 2 ? atoi(argv[2]) : 1000000;
+  std::vector<struct pkt> pkts(npkts);
+  std::vector<const struct pkt *> ptrs(npkts);
+  std::vector<unsigned char> bad(npkts);
+  struct pkt p, q;
+  double t, compute, verify;
+  long sink = 0, missed;
+  int alg, d, i, rounds, r;
+
+  if (npkts <= 0 || trials <= 0) {
+    fprintf(stderr, "usage: %s [packets [trials]]\n", argv[0]);
+    return -1;
+  }
+  for (i = 0; i < NCOVERED; i++)
+    covered[i] = i < 8 ? i : i + 4;
+  srand(1);
+  for (i = 0; i < npkts; i++) {
+    random_pkt(&pkts[i], i);
+    ptrs[i] = &pkts[i];
+  }
+  rounds = 20000000 / npkts + 1;
+
+  printf("%d-packet window, %d bytes covered per packet, crc32c %s\n\n",
+         npkts, NCOVERED, checksum_hw() ? "in hardware (SSE4.2)" : "table-driven");
+  printf("%-8s %12s %12s\n", "", "ns/byte", "verify");
+  for (alg = 0; alg < CKSUM_NALGS; alg++) {
+    checksum_set(checksum_name(alg));
+    t = now();
+    for (r = 0; r < rounds; r++)
+      for (i = 0; i < npkts; i++)
+        sink += pkts[i].checksum = pkt_checksum(&pkts[i]);
+    compute = (now() - t) * 1e9 / ((double)rounds * npkts * NCOVERED);
+    t = now();
+    for (r = 0; r < rounds; r++)
+      sink += pkt_verify_batch(&ptrs[0], npkts, &bad[0]);
+    verify = (now() - t) * 1e9 / ((double)rounds * npkts * NCOVERED);
+    printf("%-8s %12.3f %12.3f\n", checksum_name(alg), compute, verify);
+  }
+
+  printf("\nundetected per million damaged packets (%d trials each)\n", trials);
+  printf("%-10s", "");
+  for (alg = 0; alg < CKSUM_NALGS; alg++)
+    printf(" %10s", checksum_name(alg));
+  printf("\n");
+  for (d = 0; d < NDAMAGES; d++) {
+    printf("%-10s", damages[d].name);
+    for (alg = 0; alg < CKSUM_NALGS; alg++) {
+      srand(d + 1);            /* every algorithm sees the same damage */
+      missed = 0;
+      for (i = 0; i < trials; i++) {
+        random_pkt(&p, rand() % 1024);
+        p.checksum = pkt_checksum_alg(alg, &p);
+        q = p;
+        damages[d].apply(&q);
+        if (pkt_checksum_alg(alg, &q) == q.checksum)
+          missed++;
+      }
+      printf(" %10.1f", missed * 1e6 / trials);
+    }
+    printf("\n");
+  }
+  return sink == 42;           /* keep the timed loops from being optimized out */
+}
@@ -1,4 +1,6 @@
-#include "../include/simulator.h"
+#include "../include/protocol.h"
+
+namespace {
 
 /* ******************************************************************
  ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
@@ -48,9 +50,19 @@ void B_input(struct pkt packet)
 
 }
 
+/* called when B's timer goes off */
+void B_timerinterrupt()
+{
+
+}
+
 /* the following rouytine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init()
 {
 
 }
+
+}
+
+REGISTER_PROTOCOL("sr")
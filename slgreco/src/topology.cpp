@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "../include/topology.h"
+
+/*****************************************************************
+ Multi-hop network emulation.  With a topology loaded, tolayer3()
+ no longer uses the single random channel for loss and delay: each
+ packet is queued, serialized, lost and delayed link by link along
+ the path, and the simulator schedules an event at every router so
+ that traffic from all flows meets at the links in time order.
+******************************************************************/
+
+extern int TRACE;
+
+struct hop {
+  int from, to;            /* node indices */
+  float loss;
+  float delay;
+  int lost;                /* packets lost in transit */
+  struct link q;           /* queue and serializer for this direction */
+};
+
+std::vector<std::string> nodes;
+std::vector<struct hop> hops;      /* two per duplex link */
+std::vector<int> paths[2];         /* hop indices from A to B and from B to A */
+int topo_loaded = 0;
+
+int node_index(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; i < nodes.size(); i++)
+    if (nodes[i] == name)
+      return i;
+  nodes.push_back(name);
+  return nodes.size() - 1;
+}
+
+/* fewest-hop path from src to dst by breadth-first search */
+int find_path(int src, int dst, std::vector<int> &path)
+{
+  std::vector<int> via(nodes.size(), -1);   /* hop used to reach each node */
+  std::vector<int> frontier(1, src);
+  unsigned int i, h;
+  int n;
+
+  for (i = 0; i < frontier.size() && via[dst] < 0; i++)
+    for (h = 0; h < hops.size(); h++) {
+      n = hops[h].to;
+      if (hops[h].from == frontier[i] && n != src && via[n] < 0) {
+        via[n] = h;
+        frontier.push_back(n);
+      }
+    }
+  if (via[dst] < 0)
+    return 0;
+
+  path.clear();
+  for (n = dst; n != src; n = hops[via[n]].from)
+    path.insert(path.begin(), via[n]);
+  return 1;
+}
+
+int topology_load(const char *path)
+{
+  FILE *fp;
+  char line[256], a[64], b[64], kw[16];
+  struct hop h;
+  int lineno = 0, queue, src, dst;
+  float bw;
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    perror(path);
+    return 0;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if (sscanf(line, "%15s", kw) != 1 || kw[0] == '#')
+      continue;
+    memset(&h, 0, sizeof(h));
+    if (strcmp(kw, "link") != 0 ||
+        sscanf(line, "%*s %63s %63s %f %f %f %d", a, b, &h.loss, &h.delay, &bw, &queue) != 6 ||
+        h.loss < 0.0 || h.loss > 1.0 || h.delay < 0.0 || bw < 0.0 || queue < 0 ||
+        strcmp(a, b) == 0) {
+      fprintf(stderr, "%s:%d: malformed link\n", path, lineno);
+      fclose(fp);
+      return 0;
+    }
+    h.q.rate = bw;
+    h.q.queue = queue;
+    h.from = node_index(a);
+    h.to = node_index(b);
+    hops.push_back(h);
+    std::swap(h.from, h.to);
+    hops.push_back(h);
+  }
+  fclose(fp);
+
+  src = node_index("A");
+  dst = node_index("B");
+  if (!find_path(src, dst, paths[0]) || !find_path(dst, src, paths[1])) {
+    fprintf(stderr, "%s: no path between A and B\n", path);
+    return 0;
+  }
+  topo_loaded = 1;
+  return 1;
+}
+
+int topology_active()
+{
+  return topo_loaded;
+}
+
+int topology_hop(int AorB, int hop, float now, float *arrive, int *last)
+{
+  struct hop *h = &hops[paths[AorB][hop]];
+  float depart;
+
+  if (!link_admit(&h->q, now, &depart)) {
+    if (TRACE>0)
+      printf("          ROUTER: packet dropped at %s->%s queue\n",
+             nodes[h->from].c_str(), nodes[h->to].c_str());
+    return 0;
+  }
+  if (jimsrand() < h->loss) {
+    h->lost++;
+    if (TRACE>0)
+      printf("          ROUTER: packet lost on %s->%s\n",
+             nodes[h->from].c_str(), nodes[h->to].c_str());
+    return 0;
+  }
+  *arrive = depart + h->delay;
+  *last = hop + 1 == (int)paths[AorB].size();
+  return 1;
+}
+
+void topology_report(float now)
+{
+  unsigned int i, d;
+  struct hop *h;
+
+  if (!topo_loaded)
+    return;
+
+  printf("\nTopology statistics:\n");
+  for (d = 0; d < 2; d++) {
+    printf(" path %s:", d == 0 ? "A->B" : "B->A");
+    printf(" %s", nodes[hops[paths[d][0]].from].c_str());
+    for (i = 0; i < paths[d].size(); i++)
+      printf(" %s", nodes[hops[paths[d][i]].to].c_str());
+    printf(" (%d hops)\n", (int)paths[d].size());
+  }
+  for (i = 0; i < hops.size(); i++) {
+    h = &hops[i];
+    if (h->q.sent == 0 && h->q.drops == 0)
+      continue;
+    printf(" link %s->%s: sent %d, queue drops %d, lost %d, max backlog %d",
+           nodes[h->from].c_str(), nodes[h->to].c_str(),
+           h->q.sent, h->q.drops, h->lost, h->q.maxq);
+    if (h->q.rate > 0.0 && now > 0.0)
+      printf(", utilization %f", h->q.sent / (h->q.rate * now));
+    printf("\n");
+  }
+}
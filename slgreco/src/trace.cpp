@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/trace.h"
+
+/* how much consumed data to accumulate before releasing its pages */
+#define  TRACE_RELEASE_CHUNK   (16 * 1024 * 1024)
+
+int trace_open(struct trace_reader *tr, const char *path)
+{
+  struct stat st;
+  void *p;
+
+  memset(tr, 0, sizeof(*tr));
+  tr->name = path;
+  tr->fd = open(path, O_RDONLY);
+  if (tr->fd < 0) {
+    perror(path);
+    return 0;
+  }
+  if (fstat(tr->fd, &st) < 0 || st.st_size == 0) {
+    fprintf(stderr, "%s: empty or unreadable trace\n", path);
+    close(tr->fd);
+    return 0;
+  }
+  tr->len = st.st_size;
+  p = mmap(NULL, tr->len, PROT_READ, MAP_PRIVATE, tr->fd, 0);
+  if (p == MAP_FAILED) {
+    perror(path);
+    close(tr->fd);
+    return 0;
+  }
+  madvise(p, tr->len, MADV_SEQUENTIAL);
+  tr->base = (const char *)p;
+  tr->line = 1;
+  return 1;
+}
+
+void trace_close(struct trace_reader *tr)
+{
+  if (tr->base == NULL)
+    return;
+  munmap((void *)tr->base, tr->len);
+  close(tr->fd);
+  tr->base = NULL;
+}
+
+/* drop the pages behind the read cursor once enough has been consumed */
+void trace_release(struct trace_reader *tr)
+{
+  long pagesz = sysconf(_SC_PAGESIZE);
+  size_t end = tr->pos - tr->pos % pagesz;
+
+  if (end - tr->released < TRACE_RELEASE_CHUNK)
+    return;
+  madvise((void *)(tr->base + tr->released), end - tr->released, MADV_DONTNEED);
+  tr->released = end;
+}
+
+/* the mapping is not NUL terminated, so the field parsers below are all  */
+/* bounded by the file length rather than using strtol()/strtod().        */
+void skip_blanks(struct trace_reader *tr)
+{
+  while (tr->pos < tr->len && (tr->base[tr->pos] == ' ' || tr->base[tr->pos] == '\t'))
+    tr->pos++;
+}
+
+/* a field ends at a blank or at the end of the line */
+int field_end(struct trace_reader *tr)
+{
+  char c = tr->pos < tr->len ? tr->base[tr->pos] : '\n';
+
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* print where the trace went wrong, and stop */
+void bad_record(struct trace_reader *tr, const char *why)
+{
+  fprintf(stderr, "%s:%ld: malformed trace record: %s\n", tr->name, tr->line, why);
+  exit(-1);
+}
+
+/* a decimal integer from 0 to max; anything else fails */
+int parse_int(struct trace_reader *tr, int *val, int max)
+{
+  int n = 0, d, digits = 0;
+
+  skip_blanks(tr);
+  while (tr->pos < tr->len && tr->base[tr->pos] >= '0' && tr->base[tr->pos] <= '9') {
+    d = tr->base[tr->pos] - '0';
+    if (n > (INT_MAX - d) / 10)
+      return 0;
+    n = n*10 + d;
+    tr->pos++;
+    digits++;
+  }
+  if (digits == 0 || !field_end(tr) || n > max)
+    return 0;
+  *val = n;
+  return 1;
+}
+
+int parse_float(struct trace_reader *tr, float *val)
+{
+  double n = 0.0, scale = 1.0;
+  int digits = 0;
+
+  skip_blanks(tr);
+  while (tr->pos < tr->len && tr->base[tr->pos] >= '0' && tr->base[tr->pos] <= '9') {
+    n = n*10 + (tr->base[tr->pos] - '0');
+    tr->pos++;
+    digits++;
+  }
+  if (tr->pos < tr->len && tr->base[tr->pos] == '.') {
+    tr->pos++;
+    while (tr->pos < tr->len && tr->base[tr->pos] >= '0' && tr->base[tr->pos] <= '9') {
+      scale /= 10;
+      n += scale * (tr->base[tr->pos] - '0');
+      tr->pos++;
+      digits++;
+    }
+  }
+  if (digits == 0 || !field_end(tr))
+    return 0;
+  if (n > FLT_MAX)
+    bad_record(tr, "delay out of range");
+  *val = (float)n;
+  return 1;
+}
+
+void skip_line(struct trace_reader *tr)
+{
+  while (tr->pos < tr->len && tr->base[tr->pos] != '\n')
+    tr->pos++;
+  if (tr->pos < tr->len) {
+    tr->pos++;
+    tr->line++;
+  }
+}
+
+/* return the next record, restarting from the top of the file when the */
+/* trace runs out.  A malformed line is fatal: a field that is missing, */
+/* out of range or not followed by a blank, or text after the record.   */
+int trace_next(struct trace_reader *tr, struct trace_rec *rec)
+{
+  char c;
+
+  while (1) {
+    if (tr->pos >= tr->len) {
+      if (tr->records == 0) {
+        fprintf(stderr, "%s: trace holds no records\n", tr->name);
+        exit(-1);
+      }
+      /* wrap around: forget what was released and map from the start */
+      tr->pos = 0;
+      tr->released = 0;
+      tr->line = 1;
+      tr->wraps++;
+    }
+    skip_blanks(tr);
+    c = tr->pos < tr->len ? tr->base[tr->pos] : '\n';
+    if (c == '\n' || c == '\r' || c == '#') {
+      skip_line(tr);
+      continue;
+    }
+    if (!parse_int(tr, &rec->lost, 1))
+      bad_record(tr, "lost is not 0 or 1");
+    if (!parse_float(tr, &rec->delay))
+      bad_record(tr, "delay is not a number");
+    if (!parse_int(tr, &rec->corrupt, 3))
+      bad_record(tr, "corrupt is not 0 to 3");
+    skip_blanks(tr);
+    if (tr->pos < tr->len && tr->base[tr->pos] == '\r')
+      tr->pos++;
+    if (tr->pos < tr->len && tr->base[tr->pos] != '\n')
+      bad_record(tr, "text after the third field");
+    skip_line(tr);
+    trace_release(tr);
+    tr->records++;
+    return 1;
+  }
+}
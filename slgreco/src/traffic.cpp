@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+#include "../include/traffic.h"
+
+/*****************************************************************
+ Traffic sources for generate_next_arrival().  The on/off source
+ alternates exponentially distributed on and off periods; while on,
+ messages arrive as a Poisson process fast enough that the long-run
+ mean gap is still lambda.  A trace file lists arrival times, one
+ per line, as "<time> [flow]"; a line without a flow applies to
+ every flow.  Blank lines and lines starting with '#' are skipped.
+******************************************************************/
+
+struct source {
+  unsigned short xsubi[3];     /* erand48() state */
+  int on;                      /* on/off: currently in an on period */
+  double left;                 /* on/off: time left in the current period */
+  unsigned int next;           /* trace: index of the next arrival */
+  std::vector<double> times;   /* trace: arrival times */
+};
+
+int tf_model = TRAFFIC_LEGACY;
+float tf_mean_gap;
+float tf_on_mean, tf_off_mean;       /* on/off period means */
+const char *tf_trace_path;
+std::vector<struct source> tf_sources;
+
+/* statistics */
+long tf_arrivals = 0;
+double tf_gap_sum = 0.0, tf_gap_sumsq = 0.0;
+
+int traffic_set(const char *arg)
+{
+  if (strcmp(arg, "uniform") == 0)
+    tf_model = TRAFFIC_UNIFORM;
+  else if (strcmp(arg, "poisson") == 0)
+    tf_model = TRAFFIC_POISSON;
+  else if (strcmp(arg, "saturate") == 0)
+    tf_model = TRAFFIC_SATURATE;
+  else if (strncmp(arg, "onoff:", 6) == 0) {
+    if (sscanf(arg + 6, "%f,%f", &tf_on_mean, &tf_off_mean) != 2 ||
+        tf_on_mean <= 0.0 || tf_off_mean < 0.0)
+      return 0;
+    tf_model = TRAFFIC_ONOFF;
+  }
+  else if (strncmp(arg, "trace:", 6) == 0 && arg[6] != '\0') {
+    tf_trace_path = arg + 6;
+    tf_model = TRAFFIC_TRACE;
+  }
+  else
+    return 0;
+  return 1;
+}
+
+int traffic_model()
+{
+  return tf_model;
+}
+
+int traffic_drains()
+{
+  return tf_model == TRAFFIC_SATURATE || tf_model == TRAFFIC_TRACE;
+}
+
+void load_trace(int nflows)
+{
+  FILE *fp;
+  char line[256];
+  double t, last = 0.0;
+  int f, n, lineno = 0;
+  char c;
+
+  if ((fp = fopen(tf_trace_path, "r")) == NULL) {
+    perror(tf_trace_path);
+    exit(-1);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    n = sscanf(line, "%lf %d", &t, &f);
+    if (n < 1) {
+      if (sscanf(line, " %c", &c) == 1 && c != '#') {
+        fprintf(stderr, "%s:%d: malformed arrival\n", tf_trace_path, lineno);
+        exit(-1);
+      }
+      continue;
+    }
+    if (t < last || (n == 2 && (f < 0 || f >= nflows))) {
+      fprintf(stderr, "%s:%d: arrival out of order or for an unknown flow\n",
+              tf_trace_path, lineno);
+      exit(-1);
+    }
+    last = t;
+    if (n == 2)
+      tf_sources[f].times.push_back(t);
+    else
+      for (f = 0; f < nflows; f++)
+        tf_sources[f].times.push_back(t);
+  }
+  fclose(fp);
+}
+
+void traffic_init(int seed, int nflows, float lambda)
+{
+  int f;
+
+  tf_mean_gap = lambda;
+  if (tf_model == TRAFFIC_LEGACY)
+    return;
+
+  tf_sources.resize(nflows);
+  for (f = 0; f < nflows; f++) {
+    /* a stream per flow, derived from the seed but disjoint from rand() */
+    tf_sources[f].xsubi[0] = 0x330e;
+    tf_sources[f].xsubi[1] = (unsigned short)(seed ^ (f << 8));
+    tf_sources[f].xsubi[2] = (unsigned short)((seed >> 16) + f);
+    tf_sources[f].on = 0;
+    tf_sources[f].left = 0.0;
+  }
+  if (tf_model == TRAFFIC_TRACE)
+    load_trace(nflows);
+}
+
+double exponential(struct source *s, double mean)
+{
+  return -mean * log(1.0 - erand48(s->xsubi));
+}
+
+/* next arrival of an on/off source, relative to now.  Both periods are */
+/* exponential, so the time left in one can be redrawn at any point.    */
+double onoff_gap(struct source *s)
+{
+  double t = 0.0, g;
+  double peak_gap = tf_mean_gap * tf_on_mean / (tf_on_mean + tf_off_mean);
+
+  while (1) {
+    if (!s->on) {
+      t += s->left;
+      s->on = 1;
+      s->left = exponential(s, tf_on_mean);
+    }
+    g = exponential(s, peak_gap);
+    if (g <= s->left) {
+      s->left -= g;
+      return t + g;
+    }
+    t += s->left;
+    s->on = 0;
+    s->left = exponential(s, tf_off_mean);
+  }
+}
+
+float traffic_next_gap(int flow, float now)
+{
+  struct source *s = &tf_sources[flow];
+  double g;
+
+  switch (tf_model) {
+    case TRAFFIC_UNIFORM:  g = tf_mean_gap * erand48(s->xsubi) * 2;
+                           break;
+    case TRAFFIC_POISSON:  g = exponential(s, tf_mean_gap);
+                           break;
+    case TRAFFIC_ONOFF:    g = onoff_gap(s);
+                           break;
+    case TRAFFIC_SATURATE: g = 0.0;
+                           break;
+    case TRAFFIC_TRACE:    if (s->next == s->times.size())
+                             return -1;
+                           g = s->times[s->next++] - now;
+                           if (g < 0.0)
+                             g = 0.0;
+                           break;
+    default:               return -1;
+  }
+  tf_arrivals++;
+  tf_gap_sum += g;
+  tf_gap_sumsq += g*g;
+  return (float)g;
+}
+
+void traffic_report()
+{
+  static const char *names[] = { "legacy", "uniform", "poisson", "onoff", "saturate", "trace" };
+  double mean, var;
+
+  if (tf_model == TRAFFIC_LEGACY)
+    return;
+
+  mean = tf_arrivals ? tf_gap_sum / tf_arrivals : 0.0;
+  var = tf_arrivals ? tf_gap_sumsq / tf_arrivals - mean*mean : 0.0;
+  printf("\nTraffic statistics:\n");
+  printf(" source: %s, arrivals scheduled: %ld, mean gap: %f, gap cv: %f\n",
+         names[tf_model], tf_arrivals, mean, mean > 0.0 ? sqrt(var > 0.0 ? var : 0.0) / mean : 0.0);
+}